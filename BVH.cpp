@@ -1,61 +1,731 @@
 #include "BVH.hpp"
+#include "BVHStats.hpp"
 
-BVHNode::BVHNode(const std::vector<shared_ptr<Hittable>>& src_objects, size_t start, size_t end, Real time0, Real time1)
+#include <algorithm>
+#include <omp.h>
+
+BVHNode::BVHNode(const std::vector<shared_ptr<Hittable>>& src_objects, size_t start, size_t end, Real time0, Real time1, const BVHBuildOptions& options)
 {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
+    /* Bounds and centroids are computed once, the construction then only reorders them */
+    auto prims = bvh_primitive_info(src_objects, start, end, time0, time1);
+    if (prims.empty())
+        return;
 
-    int axis = random_int(0, 2);
-    auto comparator = (axis == 0) ? box_x_compare
-        : (axis == 1) ? box_y_compare
-        : box_z_compare;
+    auto root = bvh_build(prims, options);
+    convert(src_objects, prims, *root, time0, time1);
+}
 
-    size_t object_span = end - start;
+void BVHNode::convert(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, Real time0, Real time1)
+{
+    time0_ = time0;
+    time1_ = time1;
+    box = build_node.bounds_;
 
-    if (object_span == 1) {
-        left = right = objects[start];
-    } else if (object_span == 2) {
-        if (comparator(objects[start], objects[start + 1])) {
-            left = objects[start];
-            right = objects[start + 1];
-        } else {
-            left = objects[start + 1];
-            right = objects[start];
-        }
+    if (build_node.is_leaf()) {
+        left = create_child(src_objects, prims, build_node, time0, time1);
+        leaf_primitives_[0] = static_cast<uint32_t>(build_node.end_ - build_node.start_);
     } else {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
-        auto mid = start + object_span / 2;
-        left = make_shared<BVHNode>(objects, start, mid, time0, time1);
-        right = make_shared<BVHNode>(objects, mid, end, time0, time1);
+        for (int c = 0; c < 2; c++) {
+            const BVHBuildNode& child = *build_node.children_[c];
+            (c == 0 ? left : right) = create_child(src_objects, prims, child, time0, time1);
+            leaf_primitives_[c] = child.is_leaf() ? static_cast<uint32_t>(child.end_ - child.start_) : 0;
+        }
     }
 
-    AABB box_left, box_right;
+    random_hits_ = left->has_random_hits() || (right && right->has_random_hits());
+}
 
-    if (!left->bounding_box(time0, time1, box_left)
-        || !right->bounding_box(time0, time1, box_right)
-        )
-        std::cerr << "No bounding box in BVHNode constructor.\n";
+shared_ptr<Hittable> BVHNode::create_child(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, Real time0, Real time1)
+{
+    if (build_node.is_leaf()) {
+        /* Leaf, a single primitive or a list of them */
+        if (build_node.end_ - build_node.start_ == 1)
+            return src_objects[prims[build_node.start_].index_];
 
-    box = AABB::surrounding_box(box_left, box_right);
+        auto leaf = make_shared<HittableList>();
+        for (size_t i = build_node.start_; i < build_node.end_; i++)
+            leaf->add(src_objects[prims[i].index_]);
+        return leaf;
+    }
+
+    auto node = make_shared<BVHNode>();
+    node->convert(src_objects, prims, build_node, time0, time1);
+    return node;
 }
 
 bool BVHNode::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
 {
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool BVHNode::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    BVH_STATS_ADD(nodes_visited_, 1);
     if (!box.hit(r, tmin, tmax))
         return false;
 
-    bool hit_left = left->hit(r, tmin, tmax, rec);
-    bool hit_right = right->hit(r, tmin, hit_left ? rec.t_ : tmax, rec);
+    BVH_STATS_ADD(primitives_tested_, leaf_primitives_[0]);
+    bool hit_left = left->intersect(r, tmin, tmax, rec);
+    if (!right)
+        return hit_left;
+
+    BVH_STATS_ADD(primitives_tested_, leaf_primitives_[1]);
+    bool hit_right = right->intersect(r, tmin, hit_left ? rec.t_ : tmax, rec);
 
     return hit_left || hit_right;
 }
 
+bool BVHNode::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    BVH_STATS_ADD(nodes_visited_, 1);
+    if (!box.hit(r, tmin, tmax))
+        return false;
+
+    return left->occluded(r, tmin, tmax) || (right && right->occluded(r, tmin, tmax));
+}
+
 bool BVHNode::bounding_box(Real t0, Real t1, AABB & output_box) const
 {
     output_box = box;
     return true;
 }
 
+void BVHNode::refit(Real time0, Real time1)
+{
+    time0_ = time0;
+    time1_ = time1;
+    box = AABB::empty();
+
+    for (const auto& child : { left, right }) {
+        if (!child)
+            continue;
+
+        auto node = std::dynamic_pointer_cast<BVHNode>(child);
+        if (node)
+            node->refit(time0, time1);
+
+        AABB child_box;
+        if (child->bounding_box(time0, time1, child_box))
+            box.expand(child_box);
+    }
+}
+
+Real BVHNode::sah_cost(Real traversal_cost, Real intersection_cost) const
+{
+    auto area = box.surface_area();
+    auto cost = traversal_cost;
+
+    for (const auto& child : { left, right }) {
+        if (!child)
+            continue;
+
+        auto node = std::dynamic_pointer_cast<BVHNode>(child);
+        if (node) {
+            cost += node->box.surface_area() / area * node->sah_cost(traversal_cost, intersection_cost);
+            continue;
+        }
+
+        AABB child_box;
+        if (!child->bounding_box(time0_, time1_, child_box))
+            child_box = box;
+
+        auto list = std::dynamic_pointer_cast<HittableList>(child);
+        size_t primitives = list ? list->objects_.size() : 1;
+        cost += child_box.surface_area() / area * intersection_cost * primitives;
+    }
+
+    return cost;
+}
+
+std::vector<BVHPrimitiveInfo> bvh_primitive_info(const std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Real time0, Real time1)
+{
+    std::vector<BVHPrimitiveInfo> prims(end - start);
+
+    /* Like the build, small ranges and the ones of builds already in a parallel region stay on the calling thread */
+    const bool parallel = end - start > BVHBuildOptions().parallel_threshold_ && !omp_in_parallel();
+    long long unbounded = 0;
+#pragma omp parallel for schedule(static) reduction(+:unbounded) if(parallel)
+    for (long long i = start; i < static_cast<long long>(end); i++) {
+        auto& info = prims[i - start];
+        info.index_ = i;
+        if (!objects[i]->bounding_box(time0, time1, info.bounds_))
+            unbounded++;
+        info.centroid_ = info.bounds_.centroid();
+        info.splittable_ = !objects[i]->has_random_hits();
+    }
+
+    if (unbounded > 0)
+        std::cerr << "No bounding box in BVHNode constructor for " << unbounded << " objects.\n";
+
+    return prims;
+}
+
+/* Cut at the median along a random axis */
+static size_t split_random_median(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, int& axis)
+{
+    axis = random_int(0, 2);
+
+    size_t mid = start + (end - start) / 2;
+
+    std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end, [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+        return a.bounds_.min().e[axis] < b.bounds_.min().e[axis];
+    });
+
+    return mid;
+}
+
+/* Cut at the median of the centroids along the given axis, without fully sorting the range */
+static size_t split_centroid_median(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, int axis)
+{
+    size_t mid = start + (end - start) / 2;
+
+    std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end, [axis](const BVHPrimitiveInfo& a, const BVHPrimitiveInfo& b) {
+        return a.centroid_.e[axis] < b.centroid_.e[axis];
+    });
+
+    return mid;
+}
+
+/* Bounds of prims[start, end), and of their centroids */
+static void range_bounds(const std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, AABB& bounds, AABB& centroid_bounds)
+{
+    bounds = AABB::empty();
+    centroid_bounds = AABB::empty();
+    for (size_t i = start; i < end; i++) {
+        bounds.expand(prims[i].bounds_);
+        centroid_bounds.expand(prims[i].centroid_);
+    }
+}
+
+/* Best binned SAH object split of a range */
+struct SAHSplit {
+    /* Sum over both sides of the primitive count times the surface area, infinity if none was found */
+    Real cost_ = infinity;
+    int axis_ = -1;
+    /* Last bucket of the left side */
+    int bucket_ = -1;
+    AABB left_bounds_, right_bounds_;
+};
+
+static const int max_buckets = 64;
+
+static int sah_buckets(const BVHBuildOptions& options)
+{
+    return std::min(std::max(options.sah_buckets_, 2), max_buckets);
+}
+
+static SAHSplit find_sah_split(const std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const AABB& centroid_bounds, const BVHBuildOptions& options)
+{
+    struct Bucket {
+        size_t count_;
+        AABB bounds_;
+    };
+
+    const int nbuckets = sah_buckets(options);
+    Bucket buckets[3][max_buckets];
+    Real cost_below[max_buckets - 1];
+    AABB bounds_below[max_buckets - 1];
+
+    Real scale[3];
+    for (int a = 0; a < 3; a++) {
+        auto extent = centroid_bounds.max()[a] - centroid_bounds.min()[a];
+        scale[a] = extent > 0 ? nbuckets / extent : 0;
+        for (int i = 0; i < nbuckets; i++) {
+            buckets[a][i].count_ = 0;
+            buckets[a][i].bounds_ = AABB::empty();
+        }
+    }
+
+    /* Bin along the three axes in a single pass over the primitives */
+    for (size_t i = start; i < end; i++) {
+        for (int a = 0; a < 3; a++) {
+            int b = static_cast<int>((prims[i].centroid_.e[a] - centroid_bounds.min_.e[a]) * scale[a]);
+            auto& bucket = buckets[a][b < nbuckets - 1 ? b : nbuckets - 1];
+            bucket.count_++;
+            bucket.bounds_.expand(prims[i].bounds_);
+        }
+    }
+
+    SAHSplit best;
+
+    for (int a = 0; a < 3; a++) {
+        if (scale[a] == 0)
+            continue;
+
+        /* Sweep from the left, then from the right, to get the cost of splitting after each bucket */
+        AABB below = AABB::empty();
+        size_t count_below = 0;
+        for (int i = 0; i < nbuckets - 1; i++) {
+            below.expand(buckets[a][i].bounds_);
+            count_below += buckets[a][i].count_;
+            cost_below[i] = count_below * below.surface_area();
+            bounds_below[i] = below;
+        }
+
+        AABB above = AABB::empty();
+        size_t count_above = 0;
+        for (int i = nbuckets - 1; i > 0; i--) {
+            above.expand(buckets[a][i].bounds_);
+            count_above += buckets[a][i].count_;
+
+            auto cost = cost_below[i - 1] + count_above * above.surface_area();
+            if (cost < best.cost_) {
+                best.cost_ = cost;
+                best.axis_ = a;
+                best.bucket_ = i - 1;
+                best.left_bounds_ = bounds_below[i - 1];
+                best.right_bounds_ = above;
+            }
+        }
+    }
+
+    return best;
+}
+
+/* Partition prims[start, end) by the buckets of split, returns the first primitive of the right side */
+static size_t partition_sah(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const AABB& centroid_bounds, const BVHBuildOptions& options, const SAHSplit& split)
+{
+    const int nbuckets = sah_buckets(options);
+    int a = split.axis_;
+    Real scale = nbuckets / (centroid_bounds.max()[a] - centroid_bounds.min()[a]);
+
+    auto mid = std::partition(prims.begin() + start, prims.begin() + end, [&](const BVHPrimitiveInfo& prim) {
+        int b = static_cast<int>((prim.centroid_.e[a] - centroid_bounds.min_.e[a]) * scale);
+        return (b < nbuckets - 1 ? b : nbuckets - 1) <= split.bucket_;
+    });
+
+    return static_cast<size_t>(mid - prims.begin());
+}
+
+static size_t split_sah(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const AABB& bounds, const AABB& centroid_bounds, const BVHBuildOptions& options, int& axis)
+{
+    size_t span = end - start;
+
+    /* All the centroids on the same point, the bins can't separate them */
+    axis = centroid_bounds.longest_axis();
+    if (centroid_bounds.max()[axis] <= centroid_bounds.min()[axis]) {
+        if (span <= options.max_leaf_size_)
+            return start;
+        return split_centroid_median(prims, start, end, axis);
+    }
+
+    SAHSplit best = find_sah_split(prims, start, end, centroid_bounds, options);
+
+    Real best_cost = options.traversal_cost_ + options.intersection_cost_ * best.cost_ / bounds.surface_area();
+    Real leaf_cost = options.intersection_cost_ * span;
+
+    if (span <= options.max_leaf_size_ && leaf_cost <= best_cost)
+        return start;
+
+    axis = best.axis_;
+    size_t split = partition_sah(prims, start, end, centroid_bounds, options, best);
+    if (split == start || split == end)
+        return split_centroid_median(prims, start, end, best.axis_);
+
+    return split;
+}
+
+/* Split with known range bounds */
+static size_t split(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const AABB& bounds, const AABB& centroid_bounds, const BVHBuildOptions& options, int& axis)
+{
+    axis = 0;
+    if (end - start <= 1)
+        return start;
+
+    switch (options.split_method_) {
+    case BVHSplitMethod::RANDOM_MEDIAN:
+        return split_random_median(prims, start, end, axis);
+    /* A single split can't duplicate references, the spatial splits are only done by the SBVH build */
+    case BVHSplitMethod::SBVH:
+    case BVHSplitMethod::SAH:
+    default:
+        return split_sah(prims, start, end, bounds, centroid_bounds, options, axis);
+    }
+}
+
+size_t bvh_split(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const BVHBuildOptions& options, int* split_axis)
+{
+    AABB bounds, centroid_bounds;
+    range_bounds(prims, start, end, bounds, centroid_bounds);
+
+    int axis;
+    size_t mid = split(prims, start, end, bounds, centroid_bounds, options, axis);
+
+    if (split_axis)
+        *split_axis = axis;
+    return mid;
+}
+
+static std::unique_ptr<BVHBuildNode> build_recursive(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, int depth, const BVHBuildOptions& options)
+{
+    std::unique_ptr<BVHBuildNode> node(new BVHBuildNode());
+    node->start_ = start;
+    node->end_ = end;
+    node->axis_ = 0;
+
+    AABB centroid_bounds;
+    range_bounds(prims, start, end, node->bounds_, centroid_bounds);
+
+    size_t mid;
+    if (end - start > 1 && depth >= options.max_depth_ / 2) {
+        /* Balanced splits from here on, to bound the depth of the tree */
+        node->axis_ = centroid_bounds.longest_axis();
+        mid = split_centroid_median(prims, start, end, node->axis_);
+    } else {
+        mid = split(prims, start, end, node->bounds_, centroid_bounds, options, node->axis_);
+    }
+
+    if (mid == start)
+        return node;
+
+    /* The random split draws from the shared generator, so it stays on one thread */
+    bool parallel = end - start > options.parallel_threshold_ && options.split_method_ != BVHSplitMethod::RANDOM_MEDIAN;
+    if (parallel) {
+        /* Build the first half on another thread */
+#pragma omp task shared(prims, node, options)
+        node->children_[0] = build_recursive(prims, start, mid, depth + 1, options);
+        node->children_[1] = build_recursive(prims, mid, end, depth + 1, options);
+#pragma omp taskwait
+    } else {
+        node->children_[0] = build_recursive(prims, start, mid, depth + 1, options);
+        node->children_[1] = build_recursive(prims, mid, end, depth + 1, options);
+    }
+
+    return node;
+}
+
+/* Best binned spatial split of a node, the plane is on a bin boundary */
+struct SpatialSplit {
+    /* Sum over both sides of the reference count times the surface area, infinity if none was found */
+    Real cost_ = infinity;
+    int axis_ = -1;
+    Real position_ = 0;
+    AABB left_bounds_, right_bounds_;
+    size_t left_count_ = 0, right_count_ = 0;
+};
+
+/* The part of box on one side of the plane at position along axis */
+static inline AABB clip_below(AABB box, int axis, Real position)
+{
+    box.max_.e[axis] = std::min(box.max_.e[axis], position);
+    return box;
+}
+
+static inline AABB clip_above(AABB box, int axis, Real position)
+{
+    box.min_.e[axis] = std::max(box.min_.e[axis], position);
+    return box;
+}
+
+static inline AABB box_union(AABB a, const AABB& b)
+{
+    a.expand(b);
+    return a;
+}
+
+static inline AABB box_intersection(const AABB& a, const AABB& b)
+{
+    AABB box;
+    for (int i = 0; i < 3; i++) {
+        box.min_.e[i] = std::max(a.min_.e[i], b.min_.e[i]);
+        box.max_.e[i] = std::min(a.max_.e[i], b.max_.e[i]);
+    }
+    return box;
+}
+
+static SpatialSplit find_spatial_split(const std::vector<BVHPrimitiveInfo>& refs, const AABB& bounds, const BVHBuildOptions& options)
+{
+    struct Bin {
+        AABB bounds_;
+        /* References that start and end in the bin */
+        size_t entries_, exits_;
+    };
+
+    const int nbins = sah_buckets(options);
+    Bin bins[max_buckets];
+    Real cost_below[max_buckets - 1];
+    AABB bounds_below[max_buckets - 1];
+    size_t count_below_bins[max_buckets - 1];
+
+    SpatialSplit best;
+
+    for (int a = 0; a < 3; a++) {
+        Real origin = bounds.min()[a];
+        Real bin_size = (bounds.max()[a] - origin) / nbins;
+        if (bin_size <= 0)
+            continue;
+
+        for (int i = 0; i < nbins; i++) {
+            bins[i].bounds_ = AABB::empty();
+            bins[i].entries_ = 0;
+            bins[i].exits_ = 0;
+        }
+
+        /* Every reference is clipped to all the bins it crosses */
+        for (const auto& ref : refs) {
+            int first = clamp(static_cast<int>((ref.bounds_.min()[a] - origin) / bin_size), 0, nbins - 1);
+            int last = clamp(static_cast<int>((ref.bounds_.max()[a] - origin) / bin_size), first, nbins - 1);
+            if (!ref.splittable_)
+                last = first;
+
+            bins[first].entries_++;
+            bins[last].exits_++;
+            if (first == last) {
+                bins[first].bounds_.expand(ref.bounds_);
+                continue;
+            }
+            for (int b = first; b <= last; b++) {
+                AABB clipped = ref.bounds_;
+                if (b > first)
+                    clipped = clip_above(clipped, a, origin + b * bin_size);
+                if (b < last)
+                    clipped = clip_below(clipped, a, origin + (b + 1) * bin_size);
+                bins[b].bounds_.expand(clipped);
+            }
+        }
+
+        AABB below = AABB::empty();
+        size_t count_below = 0;
+        for (int i = 0; i < nbins - 1; i++) {
+            below.expand(bins[i].bounds_);
+            count_below += bins[i].entries_;
+            cost_below[i] = count_below * below.surface_area();
+            bounds_below[i] = below;
+            count_below_bins[i] = count_below;
+        }
+
+        AABB above = AABB::empty();
+        size_t count_above = 0;
+        for (int i = nbins - 1; i > 0; i--) {
+            above.expand(bins[i].bounds_);
+            count_above += bins[i].exits_;
+
+            auto cost = cost_below[i - 1] + count_above * above.surface_area();
+            if (cost < best.cost_ && count_below_bins[i - 1] > 0 && count_above > 0) {
+                best.cost_ = cost;
+                best.axis_ = a;
+                best.position_ = origin + i * bin_size;
+                best.left_bounds_ = bounds_below[i - 1];
+                best.right_bounds_ = above;
+                best.left_count_ = count_below_bins[i - 1];
+                best.right_count_ = count_above;
+            }
+        }
+    }
+
+    return best;
+}
+
+/*
+    Builds a tree with spatial splits. Every node owns the vector of its references, since they can't be
+    partitioned in place once they are duplicated. Leaves append their references to the output in order
+*/
+class SBVHBuilder {
+public:
+    SBVHBuilder(size_t primitives, const AABB& root_bounds, const BVHBuildOptions& options)
+        : options_(options), root_area_(root_bounds.surface_area()),
+          budget_(static_cast<size_t>(std::max<Real>(options.spatial_split_budget_, 0) * primitives)) {
+        references_.reserve(primitives + budget_);
+    }
+
+    std::unique_ptr<BVHBuildNode> build(std::vector<BVHPrimitiveInfo>& refs, int depth);
+
+    /* The references, in leaf order */
+    std::vector<BVHPrimitiveInfo> references_;
+
+private:
+    std::unique_ptr<BVHBuildNode> make_leaf(std::unique_ptr<BVHBuildNode> node, std::vector<BVHPrimitiveInfo>& refs);
+
+    /* Move the references to the sides of the split, duplicating those that straddle the plane when it pays off */
+    void partition_spatial(std::vector<BVHPrimitiveInfo>& refs, const SpatialSplit& split, std::vector<BVHPrimitiveInfo>& left, std::vector<BVHPrimitiveInfo>& right);
+
+    const BVHBuildOptions& options_;
+    Real root_area_;
+    /* Remaining number of extra references */
+    size_t budget_;
+};
+
+std::unique_ptr<BVHBuildNode> SBVHBuilder::make_leaf(std::unique_ptr<BVHBuildNode> node, std::vector<BVHPrimitiveInfo>& refs)
+{
+    node->start_ = references_.size();
+    references_.insert(references_.end(), refs.begin(), refs.end());
+    node->end_ = references_.size();
+    return node;
+}
+
+void SBVHBuilder::partition_spatial(std::vector<BVHPrimitiveInfo>& refs, const SpatialSplit& split, std::vector<BVHPrimitiveInfo>& left, std::vector<BVHPrimitiveInfo>& right)
+{
+    int a = split.axis_;
+    Real left_area = split.left_bounds_.surface_area();
+    Real right_area = split.right_bounds_.surface_area();
+    Real left_count = static_cast<Real>(split.left_count_);
+    Real right_count = static_cast<Real>(split.right_count_);
+
+    for (auto& ref : refs) {
+        if (ref.bounds_.max()[a] <= split.position_) {
+            left.push_back(ref);
+            continue;
+        }
+        if (ref.bounds_.min()[a] >= split.position_) {
+            right.push_back(ref);
+            continue;
+        }
+
+        /* Cost of keeping the reference whole on either side, against duplicating it */
+        Real cost_split = left_area * left_count + right_area * right_count;
+        Real cost_left = box_union(split.left_bounds_, ref.bounds_).surface_area() * left_count + right_area * (right_count - 1);
+        Real cost_right = left_area * (left_count - 1) + box_union(split.right_bounds_, ref.bounds_).surface_area() * right_count;
+
+        bool duplicate = ref.splittable_ && budget_ > 0 && cost_split < cost_left && cost_split < cost_right;
+        if (duplicate) {
+            BVHPrimitiveInfo right_ref = ref;
+            ref.bounds_ = clip_below(ref.bounds_, a, split.position_);
+            ref.centroid_ = ref.bounds_.centroid();
+            right_ref.bounds_ = clip_above(right_ref.bounds_, a, split.position_);
+            right_ref.centroid_ = right_ref.bounds_.centroid();
+            left.push_back(ref);
+            right.push_back(right_ref);
+            budget_--;
+        } else if (cost_left <= cost_right) {
+            left.push_back(ref);
+            right_count--;
+        } else {
+            right.push_back(ref);
+            left_count--;
+        }
+    }
+}
+
+std::unique_ptr<BVHBuildNode> SBVHBuilder::build(std::vector<BVHPrimitiveInfo>& refs, int depth)
+{
+    std::unique_ptr<BVHBuildNode> node(new BVHBuildNode());
+    node->axis_ = 0;
+
+    size_t n = refs.size();
+    AABB centroid_bounds;
+    range_bounds(refs, 0, n, node->bounds_, centroid_bounds);
+
+    if (n <= 1)
+        return make_leaf(std::move(node), refs);
+
+    std::vector<BVHPrimitiveInfo> left, right;
+    bool centroids_split = centroid_bounds.max()[centroid_bounds.longest_axis()] > centroid_bounds.min()[centroid_bounds.longest_axis()];
+
+    if (depth >= options_.max_depth_ / 2 || !centroids_split) {
+        /* Balanced object splits from here on, to bound the depth of the tree */
+        if (!centroids_split && n <= options_.max_leaf_size_)
+            return make_leaf(std::move(node), refs);
+        node->axis_ = centroid_bounds.longest_axis();
+        size_t mid = split_centroid_median(refs, 0, n, node->axis_);
+        left.assign(refs.begin(), refs.begin() + mid);
+        right.assign(refs.begin() + mid, refs.end());
+    } else {
+        SAHSplit object_split = find_sah_split(refs, 0, n, centroid_bounds, options_);
+
+        /* Spatial splits only pay off where the children of the object split overlap */
+        SpatialSplit spatial_split;
+        Real overlap = box_intersection(object_split.left_bounds_, object_split.right_bounds_).surface_area();
+        if (budget_ > 0 && root_area_ > 0 && overlap / root_area_ > options_.spatial_split_alpha_)
+            spatial_split = find_spatial_split(refs, node->bounds_, options_);
+
+        Real best_cost = std::min(object_split.cost_, spatial_split.cost_);
+        best_cost = options_.traversal_cost_ + options_.intersection_cost_ * best_cost / node->bounds_.surface_area();
+        Real leaf_cost = options_.intersection_cost_ * n;
+        if (n <= options_.max_leaf_size_ && leaf_cost <= best_cost)
+            return make_leaf(std::move(node), refs);
+
+        if (spatial_split.cost_ < object_split.cost_) {
+            node->axis_ = spatial_split.axis_;
+            partition_spatial(refs, spatial_split, left, right);
+        }
+
+        /* Also when the spatial split put everything on one side */
+        if (left.empty() || right.empty()) {
+            left.clear();
+            right.clear();
+            node->axis_ = object_split.axis_;
+            size_t mid = partition_sah(refs, 0, n, centroid_bounds, options_, object_split);
+            if (mid == 0 || mid == n)
+                mid = split_centroid_median(refs, 0, n, object_split.axis_);
+            left.assign(refs.begin(), refs.begin() + mid);
+            right.assign(refs.begin() + mid, refs.end());
+        }
+    }
+
+    /* The children own the references now */
+    std::vector<BVHPrimitiveInfo>().swap(refs);
+
+    node->children_[0] = build(left, depth + 1);
+    node->children_[1] = build(right, depth + 1);
+    node->start_ = node->children_[0]->start_;
+    node->end_ = node->children_[1]->end_;
+
+    return node;
+}
+
+std::unique_ptr<BVHBuildNode> bvh_build(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options)
+{
+    std::unique_ptr<BVHBuildNode> root;
+
+    if (options.split_method_ == BVHSplitMethod::SBVH && !prims.empty()) {
+        AABB bounds, centroid_bounds;
+        range_bounds(prims, 0, prims.size(), bounds, centroid_bounds);
+
+        SBVHBuilder builder(prims.size(), bounds, options);
+        root = builder.build(prims, 0);
+        prims = std::move(builder.references_);
+        return root;
+    }
+
+    /*
+        Starting the threads costs more than building the many small trees, and a build called from a parallel
+        region creates its tasks in that region
+    */
+    if (prims.size() > options.parallel_threshold_ && !omp_in_parallel()) {
+#pragma omp parallel
+#pragma omp single
+        root = build_recursive(prims, 0, prims.size(), 0, options);
+    } else {
+        root = build_recursive(prims, 0, prims.size(), 0, options);
+    }
+
+    return root;
+}
+
+int bvh_collapse_children(const BVHBuildNode& build_node, int max_children, const BVHBuildNode* children[])
+{
+    int n_children = 0;
+    if (build_node.is_leaf()) {
+        children[n_children++] = &build_node;
+        return n_children;
+    }
+
+    children[n_children++] = build_node.children_[0].get();
+    children[n_children++] = build_node.children_[1].get();
+
+    while (n_children < max_children) {
+        int largest = -1;
+        for (int c = 0; c < n_children; c++) {
+            if (children[c]->is_leaf())
+                continue;
+            if (largest < 0 || children[c]->bounds_.surface_area() > children[largest]->bounds_.surface_area())
+                largest = c;
+        }
+        if (largest < 0)
+            break;
+
+        const BVHBuildNode* opened = children[largest];
+        children[largest] = opened->children_[0].get();
+        children[n_children++] = opened->children_[1].get();
+    }
+
+    return n_children;
+}
+
 bool box_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis)
 {
     AABB box_a;
@@ -6,25 +6,150 @@
 #include "geometry/Hittable.hpp"
 #include "geometry/HittableList.hpp"
 
+#include <cstdint>
+#include <vector>
+
+/* How a BVH node range is split into two children */
+enum class BVHSplitMethod {
+    /* Sort along a random axis, and cut at the median */
+    RANDOM_MEDIAN,
+    /* Binned surface area heuristic over the primitive centroids */
+    SAH,
+    /*
+        SAH that can also split space, referencing a primitive from both sides with its bounds clipped.
+        Better for scenes with large primitives that overlap many small ones. Built on a single thread.
+        A refit keeps the references, but not their clipped bounds
+    */
+    SBVH,
+};
+
+struct BVHBuildOptions {
+    BVHSplitMethod split_method_ = BVHSplitMethod::SAH;
+    /* Maximum number of primitives in a leaf. SAH only, the median split always splits down to single primitives */
+    size_t max_leaf_size_ = 4;
+    /* Number of centroid bins per axis, used by the SAH split */
+    int sah_buckets_ = 16;
+    /* Relative cost of visiting a node, and of intersecting a primitive */
+    Real traversal_cost_ = 1.0;
+    Real intersection_cost_ = 1.0;
+    /* Ranges with more primitives than this are built as separate OpenMP tasks, smaller trees on the calling thread */
+    size_t parallel_threshold_ = 4096;
+    /* Past half this depth, ranges are split at the centroid median, so the tree never gets deeper than this */
+    int max_depth_ = 64;
+    /* SBVH only: maximum number of extra primitive references, relative to the number of primitives */
+    Real spatial_split_budget_ = 0.3;
+    /*
+        SBVH only: spatial splits are only tried where the children of the best object split overlap by
+        more than this, relative to the area of the root
+    */
+    Real spatial_split_alpha_ = 1e-5;
+};
+
+/* Per primitive data needed during the construction */
+struct BVHPrimitiveInfo {
+    /* Index of the primitive in the source objects */
+    size_t index_;
+    AABB bounds_;
+    Point3 centroid_;
+    /* False if the primitive has to stay in a single leaf, see Hittable::has_random_hits */
+    bool splittable_ = true;
+};
+
+/*
+    Reorder prims[start, end) and return the position where the range should be split into two children.
+    Returns start if the range should become a leaf. The axis of the split is stored in split_axis, if given
+*/
+size_t bvh_split(std::vector<BVHPrimitiveInfo>& prims, size_t start, size_t end, const BVHBuildOptions& options, int* split_axis = nullptr);
+
+/* Compute the build info of objects[start, end), within the given time margin */
+std::vector<BVHPrimitiveInfo> bvh_primitive_info(const std::vector<shared_ptr<Hittable>>& objects, size_t start, size_t end, Real time0, Real time1);
+
+/* Intermediate tree created by the construction, and then converted to one of the BVH layouts */
+struct BVHBuildNode {
+    AABB bounds_;
+    /* Range of the node in the reordered primitive info array */
+    size_t start_, end_;
+    /* Split axis of interior nodes */
+    int axis_;
+    /* Null for leaves */
+    std::unique_ptr<BVHBuildNode> children_[2];
+
+    bool is_leaf() const {
+        return !children_[0];
+    }
+};
+
+/*
+    Build the tree over prims in parallel. prims are partitioned in place, every node references a contiguous range.
+    With spatial splits, prims is replaced by the primitive references in leaf order, where a primitive can appear
+    more than once, with clipped bounds
+*/
+std::unique_ptr<BVHBuildNode> bvh_build(std::vector<BVHPrimitiveInfo>& prims, const BVHBuildOptions& options);
+
+/*
+    Children of a node of a wide tree, collapsed from build_node. Grandchildren are pulled up, opening the
+    interior child with the largest area first, until there are max_children. A leaf is its own only child.
+    Returns the number of children stored in children
+*/
+int bvh_collapse_children(const BVHBuildNode& build_node, int max_children, const BVHBuildNode* children[]);
+
 
 class BVHNode : public Hittable {
 public:
     BVHNode() {};
 
-    BVHNode(const HittableList& list, Real time0, Real time1) : BVHNode(list.objects_, 0, list.objects_.size(), time0, time1) {};
+    BVHNode(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions())
+        : BVHNode(list.objects_, 0, list.objects_.size(), time0, time1, options) {};
 
-    BVHNode(const std::vector<shared_ptr<Hittable>>& src_objects, size_t start, size_t end, Real time0, Real time1);
+    BVHNode(const std::vector<shared_ptr<Hittable>>& src_objects, size_t start, size_t end, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
 
     virtual bool hit( const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
 
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
 
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /* A tree nested in another one must stay in a single leaf of it if any of its primitives must */
+    virtual bool has_random_hits() const override {
+        return random_hits_;
+    }
+
+    /* Recompute the boxes bottom up, for primitives that moved. The tree structure is kept */
+    void refit(Real time0, Real time1);
+
+    /* Expected cost of a random ray hitting the tree, based on the surface area heuristic */
+    Real sah_cost(Real traversal_cost = 1.0, Real intersection_cost = 1.0) const;
+
+    /* Number of primitives of child c if it is a leaf, 0 for child nodes */
+    uint32_t leaf_primitives(int c) const {
+        return leaf_primitives_[c];
+    }
+
+    /* Time margin the bounding boxes were computed for */
+    Real time0() const {
+        return time0_;
+    }
+
+    Real time1() const {
+        return time1_;
+    }
+
 public:
     shared_ptr<Hittable> left;
+    /* Null for leaf nodes, where all the primitives are held by left */
     shared_ptr<Hittable> right;
     AABB box;
 
 private:
+    uint32_t leaf_primitives_[2] = { 0, 0 };
+    Real time0_ = 0, time1_ = 0;
+    bool random_hits_ = false;
+
+    /* Create the node for build_node */
+    void convert(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, Real time0, Real time1);
+
+    static shared_ptr<Hittable> create_child(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, Real time0, Real time1);
 };
 
 bool box_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis);
@@ -0,0 +1,281 @@
+#include "BVHStats.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "MotionBVH.hpp"
+#include "QuantizedBVH.hpp"
+#include "WideBVH.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <vector>
+
+/* Collects the stats while a tree is walked from the root */
+class TreeStatsBuilder {
+public:
+    TreeStatsBuilder(const AABB& root_box, Real traversal_cost, Real intersection_cost)
+        : root_area_(root_box.surface_area()), traversal_cost_(traversal_cost), intersection_cost_(intersection_cost) {}
+
+    /* An interior node, and the boxes of its children */
+    void add_interior(int depth, const AABB& box, const std::vector<AABB>& children) {
+        stats_.interior_nodes_++;
+        stats_.max_depth_ = std::max(stats_.max_depth_, depth);
+        stats_.sah_cost_ += relative_area(box) * traversal_cost_;
+
+        auto area = box.surface_area();
+        Real overlap = 0;
+        for (size_t i = 0; i < children.size(); i++) {
+            for (size_t j = i + 1; j < children.size(); j++) {
+                AABB intersection(
+                    Point3(std::max(children[i].min().x(), children[j].min().x()), std::max(children[i].min().y(), children[j].min().y()), std::max(children[i].min().z(), children[j].min().z())),
+                    Point3(std::min(children[i].max().x(), children[j].max().x()), std::min(children[i].max().y(), children[j].max().y()), std::min(children[i].max().z(), children[j].max().z())));
+                overlap += intersection.surface_area();
+            }
+        }
+        if (area > 0)
+            overlap_sum_ += overlap / area;
+    }
+
+    void add_leaf(int depth, const AABB& box, size_t primitives) {
+        stats_.leaves_++;
+        stats_.primitives_ += primitives;
+        stats_.max_depth_ = std::max(stats_.max_depth_, depth);
+        stats_.leaf_sizes_[primitives]++;
+        stats_.sah_cost_ += relative_area(box) * intersection_cost_ * primitives;
+        depth_sum_ += static_cast<Real>(depth) * primitives;
+    }
+
+    BVHTreeStats finish() {
+        if (stats_.primitives_ > 0)
+            stats_.average_leaf_depth_ = depth_sum_ / stats_.primitives_;
+        if (stats_.interior_nodes_ > 0)
+            stats_.sibling_overlap_ = overlap_sum_ / stats_.interior_nodes_;
+        return stats_;
+    }
+
+private:
+    Real relative_area(const AABB& box) const {
+        return root_area_ > 0 ? box.surface_area() / root_area_ : 1;
+    }
+
+    BVHTreeStats stats_;
+    Real root_area_;
+    Real traversal_cost_, intersection_cost_;
+    Real depth_sum_ = 0;
+    Real overlap_sum_ = 0;
+};
+
+static void walk(const BVHNode& node, int depth, TreeStatsBuilder& builder)
+{
+    /* A leaf holds all its primitives in left */
+    if (!node.right) {
+        builder.add_leaf(depth, node.box, node.leaf_primitives(0));
+        return;
+    }
+
+    std::vector<AABB> children;
+    for (const auto& child : { node.left, node.right }) {
+        AABB box;
+        if (!child->bounding_box(node.time0(), node.time1(), box))
+            box = node.box;
+        children.push_back(box);
+    }
+
+    builder.add_interior(depth, node.box, children);
+    for (int c = 0; c < 2; c++) {
+        if (node.leaf_primitives(c) > 0)
+            builder.add_leaf(depth + 1, children[c], node.leaf_primitives(c));
+        else
+            walk(static_cast<const BVHNode&>(c == 0 ? *node.left : *node.right), depth + 1, builder);
+    }
+}
+
+BVHTreeStats bvh_tree_stats(const BVHNode& root, Real traversal_cost, Real intersection_cost)
+{
+    if (!root.left)
+        return BVHTreeStats();
+
+    TreeStatsBuilder builder(root.box, traversal_cost, intersection_cost);
+    walk(root, 0, builder);
+    return builder.finish();
+}
+
+static void walk(const LinearBVHNode* nodes, uint32_t index, int depth, TreeStatsBuilder& builder)
+{
+    const LinearBVHNode& node = nodes[index];
+    if (node.n_primitives_ > 0) {
+        builder.add_leaf(depth, linear_bvh_bounds(node), node.n_primitives_);
+        return;
+    }
+
+    builder.add_interior(depth, linear_bvh_bounds(node), { linear_bvh_bounds(nodes[index + 1]), linear_bvh_bounds(nodes[node.second_child_offset_]) });
+    walk(nodes, index + 1, depth + 1, builder);
+    walk(nodes, node.second_child_offset_, depth + 1, builder);
+}
+
+BVHTreeStats bvh_tree_stats(const LinearBVHNode* nodes, size_t n_nodes, Real traversal_cost, Real intersection_cost)
+{
+    if (n_nodes == 0)
+        return BVHTreeStats();
+
+    TreeStatsBuilder builder(linear_bvh_bounds(nodes[0]), traversal_cost, intersection_cost);
+    walk(nodes, 0, 0, builder);
+    return builder.finish();
+}
+
+static void walk(const WideBVH& bvh, uint32_t index, const AABB& box, int depth, TreeStatsBuilder& builder)
+{
+    const WideBVHNode& node = bvh.nodes_[index];
+
+    std::vector<AABB> children;
+    std::vector<int> slots;
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        /* Only the root has index 0, so an interior slot never has a zero offset */
+        if (node.n_primitives_[c] == 0 && node.offset_[c] == 0)
+            continue;
+        children.push_back(AABB(
+            Point3(node.bounds_min_[0][c], node.bounds_min_[1][c], node.bounds_min_[2][c]),
+            Point3(node.bounds_max_[0][c], node.bounds_max_[1][c], node.bounds_max_[2][c])));
+        slots.push_back(c);
+    }
+
+    builder.add_interior(depth, box, children);
+    for (size_t i = 0; i < slots.size(); i++) {
+        int c = slots[i];
+        if (node.n_primitives_[c] > 0)
+            builder.add_leaf(depth + 1, children[i], node.n_primitives_[c]);
+        else
+            walk(bvh, node.offset_[c], children[i], depth + 1, builder);
+    }
+}
+
+BVHTreeStats bvh_tree_stats(const WideBVH& bvh, Real traversal_cost, Real intersection_cost)
+{
+    if (bvh.nodes_.empty())
+        return BVHTreeStats();
+
+    TreeStatsBuilder builder(bvh.bounds_, traversal_cost, intersection_cost);
+    walk(bvh, 0, bvh.bounds_, 0, builder);
+    return builder.finish();
+}
+
+template<typename Q>
+static void walk(const QuantizedBVH<Q>& bvh, uint32_t index, const AABB& box, int depth, TreeStatsBuilder& builder)
+{
+    const QuantizedBVHNode<Q>& node = bvh.nodes_[index];
+
+    std::vector<AABB> children;
+    std::vector<int> slots;
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        if (node.n_primitives_[c] == 0 && node.offset_[c] == 0)
+            continue;
+        children.push_back(QuantizedBVH<Q>::child_bounds(node, c));
+        slots.push_back(c);
+    }
+
+    builder.add_interior(depth, box, children);
+    for (size_t i = 0; i < slots.size(); i++) {
+        int c = slots[i];
+        if (node.n_primitives_[c] > 0)
+            builder.add_leaf(depth + 1, children[i], node.n_primitives_[c]);
+        else
+            walk(bvh, node.offset_[c], children[i], depth + 1, builder);
+    }
+}
+
+template<typename Q>
+BVHTreeStats bvh_tree_stats(const QuantizedBVH<Q>& bvh, Real traversal_cost, Real intersection_cost)
+{
+    if (bvh.nodes_.empty())
+        return BVHTreeStats();
+
+    TreeStatsBuilder builder(bvh.bounds_, traversal_cost, intersection_cost);
+    walk(bvh, 0, bvh.bounds_, 0, builder);
+    return builder.finish();
+}
+
+template BVHTreeStats bvh_tree_stats(const QuantizedBVH<uint8_t>& bvh, Real traversal_cost, Real intersection_cost);
+template BVHTreeStats bvh_tree_stats(const QuantizedBVH<uint16_t>& bvh, Real traversal_cost, Real intersection_cost);
+
+static AABB motion_bvh_bounds(const MotionBVHNode& node)
+{
+    return AABB(
+        Point3(node.bounds_min_[0][0], node.bounds_min_[0][1], node.bounds_min_[0][2]),
+        Point3(node.bounds_max_[0][0], node.bounds_max_[0][1], node.bounds_max_[0][2]));
+}
+
+static void walk(const MotionBVH& bvh, uint32_t index, int depth, TreeStatsBuilder& builder)
+{
+    const MotionBVHNode& node = bvh.nodes_[index];
+    if (node.n_primitives_ > 0) {
+        builder.add_leaf(depth, motion_bvh_bounds(node), node.n_primitives_);
+        return;
+    }
+
+    builder.add_interior(depth, motion_bvh_bounds(node), { motion_bvh_bounds(bvh.nodes_[index + 1]), motion_bvh_bounds(bvh.nodes_[node.second_child_offset_]) });
+    walk(bvh, index + 1, depth + 1, builder);
+    walk(bvh, node.second_child_offset_, depth + 1, builder);
+}
+
+BVHTreeStats bvh_tree_stats(const MotionBVH& bvh, Real traversal_cost, Real intersection_cost)
+{
+    if (bvh.nodes_.empty())
+        return BVHTreeStats();
+
+    TreeStatsBuilder builder(motion_bvh_bounds(bvh.nodes_[0]), traversal_cost, intersection_cost);
+    walk(bvh, 0, 0, builder);
+    return builder.finish();
+}
+
+void BVHTreeStats::print(std::ostream & out) const
+{
+    auto flags = out.flags();
+    auto precision = out.precision();
+
+    out << "BVH nodes: " << interior_nodes_ + leaves_ << " (" << interior_nodes_ << " interior, " << leaves_ << " leaves)" << std::endl;
+    out << "BVH primitives: " << primitives_ << std::endl;
+    out << "BVH depth: max " << max_depth_ << ", average leaf " << std::fixed << std::setprecision(2) << average_leaf_depth_ << std::endl;
+    out << "BVH SAH cost: " << sah_cost_ << std::endl;
+    out << "BVH sibling overlap: " << sibling_overlap_ * 100 << "% of the parent area" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+    out << "BVH leaf sizes:" << std::endl;
+    for (const auto& size : leaf_sizes_)
+        out << "  " << std::setw(4) << size.first << " primitives: " << size.second << " leaves" << std::endl;
+}
+
+
+thread_local BVHTraversalCounters bvh_thread_counters;
+
+static std::atomic<uint64_t> total_rays(0);
+static std::atomic<uint64_t> total_nodes_visited(0);
+static std::atomic<uint64_t> total_primitives_tested(0);
+
+void bvh_stats_flush()
+{
+    total_rays += bvh_thread_counters.rays_;
+    total_nodes_visited += bvh_thread_counters.nodes_visited_;
+    total_primitives_tested += bvh_thread_counters.primitives_tested_;
+    bvh_thread_counters = BVHTraversalCounters();
+}
+
+BVHTraversalCounters bvh_stats_totals()
+{
+    BVHTraversalCounters totals;
+    totals.rays_ = total_rays;
+    totals.nodes_visited_ = total_nodes_visited;
+    totals.primitives_tested_ = total_primitives_tested;
+    return totals;
+}
+
+void BVHTraversalCounters::print(std::ostream & out) const
+{
+    if (rays_ == 0) {
+        out << "No BVH traversal counts, build with BVH_STATS to collect them" << std::endl;
+        return;
+    }
+
+    out << "Rays: " << rays_ << std::endl;
+    out << "Nodes visited per ray: " << static_cast<double>(nodes_visited_) / rays_ << std::endl;
+    out << "Primitives tested per ray: " << static_cast<double>(primitives_tested_) / rays_ << std::endl;
+}
@@ -0,0 +1,68 @@
+#ifndef __BVHStats_hpp__
+#define __BVHStats_hpp__
+
+#include "Common.hpp"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+
+class BVHNode;
+class WideBVH;
+class MotionBVH;
+struct LinearBVHNode;
+
+/* Shape and quality of a built tree */
+struct BVHTreeStats {
+    size_t interior_nodes_ = 0;
+    size_t leaves_ = 0;
+    size_t primitives_ = 0;
+    int max_depth_ = 0;
+    /* Average depth of the leaves, weighted by their primitives */
+    Real average_leaf_depth_ = 0;
+    /* Number of leaves per primitive count */
+    std::map<size_t, size_t> leaf_sizes_;
+    /* Expected cost of a random ray, based on the surface area heuristic */
+    Real sah_cost_ = 0;
+    /* Average over interior nodes of the area where two children overlap, relative to the node area */
+    Real sibling_overlap_ = 0;
+
+    void print(std::ostream& out) const;
+};
+
+BVHTreeStats bvh_tree_stats(const BVHNode& root, Real traversal_cost = 1.0, Real intersection_cost = 1.0);
+BVHTreeStats bvh_tree_stats(const LinearBVHNode* nodes, size_t n_nodes, Real traversal_cost = 1.0, Real intersection_cost = 1.0);
+BVHTreeStats bvh_tree_stats(const WideBVH& bvh, Real traversal_cost = 1.0, Real intersection_cost = 1.0);
+template<typename Q> class QuantizedBVH;
+/* Computed over the decoded bounds */
+template<typename Q>
+BVHTreeStats bvh_tree_stats(const QuantizedBVH<Q>& bvh, Real traversal_cost = 1.0, Real intersection_cost = 1.0);
+/* Computed over the bounds of the first time key */
+BVHTreeStats bvh_tree_stats(const MotionBVH& bvh, Real traversal_cost = 1.0, Real intersection_cost = 1.0);
+
+
+/* Work done by the traversals, counted only when built with BVH_STATS */
+struct BVHTraversalCounters {
+    uint64_t rays_ = 0;
+    uint64_t nodes_visited_ = 0;
+    uint64_t primitives_tested_ = 0;
+
+    void print(std::ostream& out) const;
+};
+
+/* Counters of the calling thread, moved to the totals by bvh_stats_flush */
+extern thread_local BVHTraversalCounters bvh_thread_counters;
+
+/* Add the counters of the calling thread to the totals, and reset them */
+void bvh_stats_flush();
+
+/* Sum of the flushed counters of all the threads */
+BVHTraversalCounters bvh_stats_totals();
+
+#ifdef BVH_STATS
+#define BVH_STATS_ADD(counter, n) (bvh_thread_counters.counter += (n))
+#else
+#define BVH_STATS_ADD(counter, n) ((void)0)
+#endif
+
+#endif
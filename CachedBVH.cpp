@@ -0,0 +1,199 @@
+#include "CachedBVH.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char cache_magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', '\0', '\0' };
+
+static inline void hash_word(uint64_t& hash, uint64_t word)
+{
+    hash ^= word;
+    hash *= 0x100000001b3ull;
+    hash ^= hash >> 29;
+}
+
+static inline void hash_real(uint64_t& hash, Real x)
+{
+    uint64_t word = 0;
+    double d = static_cast<double>(x);
+    std::memcpy(&word, &d, sizeof(d));
+    hash_word(hash, word);
+}
+
+uint64_t CachedBVH::scene_hash(const std::vector<BVHPrimitiveInfo>& prims, Real time0, Real time1, const BVHBuildOptions& options)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    hash_word(hash, version);
+    hash_word(hash, static_cast<uint64_t>(options.split_method_));
+    hash_word(hash, options.max_leaf_size_);
+    hash_word(hash, static_cast<uint64_t>(options.sah_buckets_));
+    hash_word(hash, static_cast<uint64_t>(options.max_depth_));
+    hash_real(hash, options.traversal_cost_);
+    hash_real(hash, options.intersection_cost_);
+    hash_real(hash, options.spatial_split_budget_);
+    hash_real(hash, options.spatial_split_alpha_);
+    hash_real(hash, time0);
+    hash_real(hash, time1);
+
+    hash_word(hash, prims.size());
+    for (const auto& prim : prims) {
+        for (int a = 0; a < 3; a++) {
+            hash_real(hash, prim.bounds_.min()[a]);
+            hash_real(hash, prim.bounds_.max()[a]);
+        }
+    }
+
+    return hash;
+}
+
+CachedBVH::CachedBVH(const HittableList& list, Real time0, Real time1, const std::string& prefix, const BVHBuildOptions& options)
+{
+    if (list.objects_.empty())
+        return;
+
+    auto build_options = LinearBVH::build_options(options);
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+    uint64_t hash = scene_hash(prims, time0, time1, build_options);
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    path_ = prefix + name + ".bvh";
+
+    if (load(path_, list, hash)) {
+        loaded_ = true;
+        return;
+    }
+
+    auto root = bvh_build(prims, build_options);
+    linear_bvh_flatten(*root, built_nodes_);
+    nodes_ = built_nodes_.data();
+    n_nodes_ = built_nodes_.size();
+
+    primitives_.reserve(prims.size());
+    for (const auto& prim : prims)
+        primitives_.push_back(list.objects_[prim.index_]);
+
+    if (!write(path_, prims, hash))
+        std::cerr << "Could not write the BVH cache " << path_ << std::endl;
+}
+
+bool CachedBVH::load(const std::string& path, const HittableList& list, uint64_t scene_hash)
+{
+    if (!file_.open(path))
+        return false;
+
+    if (file_.size() < sizeof(BVHCacheHeader)) {
+        file_.close();
+        return false;
+    }
+
+    BVHCacheHeader header;
+    std::memcpy(&header, file_.data(), sizeof(header));
+
+    uint64_t expected_size = sizeof(BVHCacheHeader) + header.n_nodes_ * sizeof(LinearBVHNode) + header.n_primitives_ * sizeof(uint32_t);
+    if (std::memcmp(header.magic_, cache_magic, sizeof(cache_magic)) != 0 || header.version_ != version
+        || header.node_size_ != sizeof(LinearBVHNode) || header.scene_hash_ != scene_hash
+        || header.n_primitives_ < list.objects_.size() || header.n_nodes_ == 0 || file_.size() != expected_size) {
+        file_.close();
+        return false;
+    }
+
+    /* The header is a multiple of 8 bytes, and mappings are page aligned, so the nodes can be used in place */
+    nodes_ = reinterpret_cast<const LinearBVHNode*>(file_.data() + sizeof(BVHCacheHeader));
+    n_nodes_ = static_cast<size_t>(header.n_nodes_);
+
+    const uint32_t* indices = reinterpret_cast<const uint32_t*>(nodes_ + n_nodes_);
+    primitives_.resize(static_cast<size_t>(header.n_primitives_));
+    for (size_t i = 0; i < primitives_.size(); i++) {
+        if (indices[i] >= list.objects_.size()) {
+            primitives_.clear();
+            nodes_ = nullptr;
+            n_nodes_ = 0;
+            file_.close();
+            return false;
+        }
+        primitives_[i] = list.objects_[indices[i]];
+    }
+
+    return true;
+}
+
+bool CachedBVH::write(const std::string& path, const std::vector<BVHPrimitiveInfo>& prims, uint64_t scene_hash) const
+{
+    BVHCacheHeader header;
+    std::memcpy(header.magic_, cache_magic, sizeof(cache_magic));
+    header.version_ = version;
+    header.node_size_ = sizeof(LinearBVHNode);
+    header.scene_hash_ = scene_hash;
+    header.n_nodes_ = n_nodes_;
+    header.n_primitives_ = prims.size();
+
+    std::vector<uint32_t> indices(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        indices[i] = static_cast<uint32_t>(prims[i].index_);
+
+    /* Written to a temporary file first, so that a concurrent or interrupted run never sees half a file */
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(nodes_), n_nodes_ * sizeof(LinearBVHNode));
+        out.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+        if (!out) {
+            out.close();
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool CachedBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool CachedBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return linear_bvh_traverse(nodes_, n_nodes_, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->intersect(r, tmin, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool CachedBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return linear_bvh_traverse<true>(nodes_, n_nodes_, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->occluded(r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool CachedBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (n_nodes_ == 0)
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef __CachedBVH_hpp__
+#define __CachedBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "MappedFile.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Header of a BVH cache file. It is followed by the LinearBVHNode array, and then by the uint32_t index
+    in the source objects of every primitive reference, in leaf order. A primitive can be referenced more than once
+*/
+struct BVHCacheHeader {
+    char magic_[8];
+    uint32_t version_;
+    /* sizeof(LinearBVHNode) of the writer */
+    uint32_t node_size_;
+    /* Hash of the primitive bounds and build options the tree was built from */
+    uint64_t scene_hash_;
+    uint64_t n_nodes_;
+    uint64_t n_primitives_;
+};
+
+static_assert(sizeof(BVHCacheHeader) == 40, "BVHCacheHeader should be 40 bytes");
+
+/*
+    A LinearBVH that is stored in a file after it is built. The file is named after the scene_hash of the
+    primitives, so every version of a scene gets its own file. If the file for the scene already exists, it
+    is memory mapped and traversed in place, and nothing is built
+*/
+class CachedBVH : public Hittable {
+public:
+    /* The file is prefix followed by the scene hash in hexadecimal and .bvh, prefix can hold a directory */
+    CachedBVH(const HittableList& list, Real time0, Real time1, const std::string& prefix, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    const LinearBVHNode* nodes() const {
+        return nodes_;
+    }
+
+    size_t node_count() const {
+        return n_nodes_;
+    }
+
+    /* True if the tree was mapped from the file, false if it was built */
+    bool loaded() const {
+        return loaded_;
+    }
+
+    /* The file the tree was mapped from or written to */
+    const std::string& path() const {
+        return path_;
+    }
+
+    /* Hash of everything the tree depends on: the primitive bounds, the time margin and the build options */
+    static uint64_t scene_hash(const std::vector<BVHPrimitiveInfo>& prims, Real time0, Real time1, const BVHBuildOptions& options);
+
+    /* Bumped whenever the file layout or the node layout changes */
+    static const uint32_t version = 1;
+
+private:
+    /* Map path and check that it holds the tree for scene_hash, returns false otherwise */
+    bool load(const std::string& path, const HittableList& list, uint64_t scene_hash);
+
+    /* Write the built tree to path, returns false on failure */
+    bool write(const std::string& path, const std::vector<BVHPrimitiveInfo>& prims, uint64_t scene_hash) const;
+
+    MappedFile file_;
+    /* Nodes, pointing either to file_ or to built_nodes_ */
+    const LinearBVHNode* nodes_ = nullptr;
+    size_t n_nodes_ = 0;
+    std::vector<LinearBVHNode> built_nodes_;
+    /* Primitives ordered so that every leaf references a contiguous range */
+    std::vector<shared_ptr<Hittable>> primitives_;
+    bool loaded_ = false;
+    std::string path_;
+};
+
+#endif
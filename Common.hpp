@@ -42,4 +42,22 @@ inline Real clamp(Real x, Real min, Real max)
     return x;
 }
 
+/* Round to the nearest float that is not above x */
+inline float round_down_float(Real x)
+{
+    float f = static_cast<float>(x);
+    if (f > x)
+        f = std::nextafter(f, -std::numeric_limits<float>::infinity());
+    return f;
+}
+
+/* Round to the nearest float that is not below x */
+inline float round_up_float(Real x)
+{
+    float f = static_cast<float>(x);
+    if (f < x)
+        f = std::nextafter(f, std::numeric_limits<float>::infinity());
+    return f;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,470 @@
+#include "DynamicBVH.hpp"
+#include "BVHStats.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+
+static inline AABB box_union(AABB a, const AABB& b)
+{
+    a.expand(b);
+    return a;
+}
+
+DynamicBVH::DynamicBVH(Real time0, Real time1, const BVHBuildOptions& options) : time0_(time0), time1_(time1), options_(options)
+{
+    /* Every leaf holds one primitive, which can't be referenced twice */
+    options_.max_leaf_size_ = 1;
+    if (options_.split_method_ == BVHSplitMethod::SBVH)
+        options_.split_method_ = BVHSplitMethod::SAH;
+    /* Leaves the build could not split any further are halved by convert, which needs some depth left */
+    options_.max_depth_ = options.max_depth_ < max_depth - 16 ? options.max_depth_ : max_depth - 16;
+}
+
+DynamicBVH::DynamicBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options) : DynamicBVH(time0, time1, options)
+{
+    primitives_ = list.objects_;
+    leaves_.assign(primitives_.size(), -1);
+    n_primitives_ = primitives_.size();
+    rebuild();
+}
+
+int DynamicBVH::allocate_node()
+{
+    if (!free_nodes_.empty()) {
+        int index = free_nodes_.back();
+        free_nodes_.pop_back();
+        return index;
+    }
+
+    nodes_.emplace_back();
+    return static_cast<int>(nodes_.size() - 1);
+}
+
+void DynamicBVH::free_node(int index)
+{
+    nodes_[index].parent_ = -1;
+    nodes_[index].children_[0] = nodes_[index].children_[1] = -1;
+    nodes_[index].primitive_ = -1;
+    free_nodes_.push_back(index);
+}
+
+int DynamicBVH::convert(const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, int parent)
+{
+    int index = allocate_node();
+    nodes_[index].bounds_ = build_node.bounds_;
+    nodes_[index].parent_ = parent;
+    nodes_[index].primitive_ = -1;
+
+    if (build_node.is_leaf()) {
+        /* Primitives with the same bounds can still end up in one leaf, those get a leaf each */
+        if (build_node.end_ - build_node.start_ == 1) {
+            int handle = static_cast<int>(prims[build_node.start_].index_);
+            nodes_[index].children_[0] = nodes_[index].children_[1] = -1;
+            nodes_[index].primitive_ = handle;
+            nodes_[index].height_ = 0;
+            leaves_[handle] = index;
+            leaf_area_ += build_node.bounds_.surface_area();
+            return index;
+        }
+
+        BVHBuildNode left, right;
+        size_t mid = build_node.start_ + (build_node.end_ - build_node.start_) / 2;
+        left.start_ = build_node.start_;
+        left.end_ = mid;
+        right.start_ = mid;
+        right.end_ = build_node.end_;
+        left.bounds_ = right.bounds_ = build_node.bounds_;
+        for (auto child : { &left, &right }) {
+            child->bounds_ = AABB::empty();
+            for (size_t i = child->start_; i < child->end_; i++)
+                child->bounds_.expand(prims[i].bounds_);
+        }
+
+        int first = convert(prims, left, index);
+        int second = convert(prims, right, index);
+        nodes_[index].children_[0] = first;
+        nodes_[index].children_[1] = second;
+    } else {
+        int first = convert(prims, *build_node.children_[0], index);
+        int second = convert(prims, *build_node.children_[1], index);
+        nodes_[index].children_[0] = first;
+        nodes_[index].children_[1] = second;
+    }
+
+    nodes_[index].height_ = 1 + std::max(nodes_[nodes_[index].children_[0]].height_, nodes_[nodes_[index].children_[1]].height_);
+    interior_area_ += build_node.bounds_.surface_area();
+    return index;
+}
+
+void DynamicBVH::rebuild()
+{
+    nodes_.clear();
+    free_nodes_.clear();
+    root_ = -1;
+    interior_area_ = leaf_area_ = 0;
+
+    /* Only the live handles are built, and keep their handle as index */
+    std::vector<BVHPrimitiveInfo> prims;
+    prims.reserve(n_primitives_);
+    for (size_t handle = 0; handle < primitives_.size(); handle++) {
+        if (!primitives_[handle])
+            continue;
+        BVHPrimitiveInfo info;
+        info.index_ = handle;
+        if (!primitives_[handle]->bounding_box(time0_, time1_, info.bounds_))
+            std::cerr << "No bounding box in DynamicBVH.\n";
+        info.centroid_ = info.bounds_.centroid();
+        prims.push_back(info);
+    }
+
+    if (!prims.empty()) {
+        auto root = bvh_build(prims, options_);
+        nodes_.reserve(2 * prims.size());
+        root_ = convert(prims, *root, -1);
+    }
+
+    built_cost_ = sah_cost();
+}
+
+Real DynamicBVH::sah_cost() const
+{
+    if (root_ < 0)
+        return 0;
+
+    auto root_area = nodes_[root_].bounds_.surface_area();
+    if (root_area <= 0)
+        return 0;
+    return (options_.traversal_cost_ * interior_area_ + options_.intersection_cost_ * leaf_area_) / root_area;
+}
+
+int DynamicBVH::insert(shared_ptr<Hittable> object)
+{
+    int handle;
+    if (!free_handles_.empty()) {
+        handle = free_handles_.back();
+        free_handles_.pop_back();
+        primitives_[handle] = object;
+    } else {
+        handle = static_cast<int>(primitives_.size());
+        primitives_.push_back(object);
+        leaves_.push_back(-1);
+    }
+    n_primitives_++;
+
+    int leaf = allocate_node();
+    nodes_[leaf].children_[0] = nodes_[leaf].children_[1] = -1;
+    nodes_[leaf].primitive_ = handle;
+    nodes_[leaf].height_ = 0;
+    if (!object->bounding_box(time0_, time1_, nodes_[leaf].bounds_))
+        std::cerr << "No bounding box in DynamicBVH.\n";
+    leaves_[handle] = leaf;
+    leaf_area_ += nodes_[leaf].bounds_.surface_area();
+
+    insert_leaf(leaf);
+    rebuild_if_degraded();
+    return handle;
+}
+
+void DynamicBVH::remove(int handle)
+{
+    int leaf = leaves_[handle];
+    remove_leaf(leaf);
+    leaf_area_ -= nodes_[leaf].bounds_.surface_area();
+    free_node(leaf);
+
+    primitives_[handle] = nullptr;
+    leaves_[handle] = -1;
+    free_handles_.push_back(handle);
+    n_primitives_--;
+
+    rebuild_if_degraded();
+}
+
+void DynamicBVH::update(int handle)
+{
+    int leaf = leaves_[handle];
+    remove_leaf(leaf);
+
+    leaf_area_ -= nodes_[leaf].bounds_.surface_area();
+    if (!primitives_[handle]->bounding_box(time0_, time1_, nodes_[leaf].bounds_))
+        std::cerr << "No bounding box in DynamicBVH.\n";
+    leaf_area_ += nodes_[leaf].bounds_.surface_area();
+
+    insert_leaf(leaf);
+    rebuild_if_degraded();
+}
+
+void DynamicBVH::insert_leaf(int leaf)
+{
+    nodes_[leaf].parent_ = -1;
+    if (root_ < 0) {
+        root_ = leaf;
+        return;
+    }
+
+    /*
+        Branch and bound search for the sibling with the smallest cost: the area of the new parent, plus the
+        area added to all the ancestors. The nodes are visited by their inherited cost, and a subtree is
+        skipped when even a child that adds no area can't beat the best found so far
+    */
+    AABB box = nodes_[leaf].bounds_;
+    auto leaf_area = box.surface_area();
+
+    struct Candidate {
+        Real inherited_cost_;
+        int node_;
+        bool operator<(const Candidate& other) const {
+            return inherited_cost_ > other.inherited_cost_;
+        }
+    };
+    std::priority_queue<Candidate> queue;
+    queue.push({ 0, root_ });
+
+    int best = root_;
+    Real best_cost = box_union(nodes_[root_].bounds_, box).surface_area();
+
+    while (!queue.empty()) {
+        Candidate candidate = queue.top();
+        queue.pop();
+        if (candidate.inherited_cost_ + leaf_area >= best_cost)
+            break;
+
+        const DynamicBVHNode& node = nodes_[candidate.node_];
+        auto direct_cost = box_union(node.bounds_, box).surface_area();
+        auto cost = direct_cost + candidate.inherited_cost_;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = candidate.node_;
+        }
+
+        if (node.is_leaf())
+            continue;
+
+        auto child_inherited_cost = candidate.inherited_cost_ + direct_cost - node.bounds_.surface_area();
+        if (child_inherited_cost + leaf_area < best_cost) {
+            queue.push({ child_inherited_cost, node.children_[0] });
+            queue.push({ child_inherited_cost, node.children_[1] });
+        }
+    }
+
+    /* New parent of the sibling and the leaf, in the place of the sibling */
+    int old_parent = nodes_[best].parent_;
+    int parent = allocate_node();
+    nodes_[parent].parent_ = old_parent;
+    nodes_[parent].children_[0] = best;
+    nodes_[parent].children_[1] = leaf;
+    nodes_[parent].primitive_ = -1;
+    nodes_[parent].bounds_ = box_union(nodes_[best].bounds_, box);
+    nodes_[parent].height_ = nodes_[best].height_ + 1;
+    interior_area_ += nodes_[parent].bounds_.surface_area();
+
+    if (old_parent < 0) {
+        root_ = parent;
+    } else {
+        auto& children = nodes_[old_parent].children_;
+        children[children[0] == best ? 0 : 1] = parent;
+    }
+    nodes_[best].parent_ = parent;
+    nodes_[leaf].parent_ = parent;
+
+    refit_ancestors(nodes_[parent].parent_);
+}
+
+void DynamicBVH::remove_leaf(int leaf)
+{
+    if (leaf == root_) {
+        root_ = -1;
+        return;
+    }
+
+    /* The sibling takes the place of the parent */
+    int parent = nodes_[leaf].parent_;
+    int grandparent = nodes_[parent].parent_;
+    int sibling = nodes_[parent].children_[nodes_[parent].children_[0] == leaf ? 1 : 0];
+
+    interior_area_ -= nodes_[parent].bounds_.surface_area();
+    free_node(parent);
+    nodes_[sibling].parent_ = grandparent;
+    nodes_[leaf].parent_ = -1;
+
+    if (grandparent < 0) {
+        root_ = sibling;
+        return;
+    }
+
+    auto& children = nodes_[grandparent].children_;
+    children[children[0] == parent ? 0 : 1] = sibling;
+    refit_ancestors(grandparent);
+}
+
+void DynamicBVH::refit_ancestors(int index)
+{
+    while (index >= 0) {
+        DynamicBVHNode& node = nodes_[index];
+        interior_area_ -= node.bounds_.surface_area();
+        node.bounds_ = box_union(nodes_[node.children_[0]].bounds_, nodes_[node.children_[1]].bounds_);
+        interior_area_ += node.bounds_.surface_area();
+
+        rotate(index);
+
+        DynamicBVHNode& rotated = nodes_[index];
+        rotated.height_ = 1 + std::max(nodes_[rotated.children_[0]].height_, nodes_[rotated.children_[1]].height_);
+        index = rotated.parent_;
+    }
+}
+
+void DynamicBVH::rotate(int index)
+{
+    /*
+        Try swapping each child with each child of its sibling. Only the area of the sibling changes, so the
+        swap that reduces it the most is done
+    */
+    DynamicBVHNode& node = nodes_[index];
+    Real best_gain = 0;
+    int best_child = -1, best_grandchild = -1;
+
+    for (int c = 0; c < 2; c++) {
+        int child = node.children_[c];
+        int sibling = node.children_[1 - c];
+        if (nodes_[sibling].is_leaf())
+            continue;
+
+        auto sibling_area = nodes_[sibling].bounds_.surface_area();
+        for (int g = 0; g < 2; g++) {
+            int kept = nodes_[sibling].children_[1 - g];
+            auto gain = sibling_area - box_union(nodes_[child].bounds_, nodes_[kept].bounds_).surface_area();
+            if (gain > best_gain) {
+                best_gain = gain;
+                best_child = c;
+                best_grandchild = g;
+            }
+        }
+    }
+
+    if (best_child < 0)
+        return;
+
+    int child = node.children_[best_child];
+    int sibling = node.children_[1 - best_child];
+    int grandchild = nodes_[sibling].children_[best_grandchild];
+    int kept = nodes_[sibling].children_[1 - best_grandchild];
+
+    node.children_[best_child] = grandchild;
+    nodes_[grandchild].parent_ = index;
+    nodes_[sibling].children_[best_grandchild] = child;
+    nodes_[child].parent_ = sibling;
+
+    interior_area_ -= nodes_[sibling].bounds_.surface_area();
+    nodes_[sibling].bounds_ = box_union(nodes_[child].bounds_, nodes_[kept].bounds_);
+    interior_area_ += nodes_[sibling].bounds_.surface_area();
+    nodes_[sibling].height_ = 1 + std::max(nodes_[child].height_, nodes_[kept].height_);
+}
+
+void DynamicBVH::rebuild_if_degraded()
+{
+    if (root_ < 0)
+        return;
+
+    bool too_deep = nodes_[root_].height_ >= max_depth;
+    bool too_costly = rebuild_threshold_ > 0 && sah_cost() > rebuild_threshold_ * built_cost_;
+    if (too_deep || too_costly)
+        rebuild();
+}
+
+/* Traverse the nodes nearest child first. intersect_leaf(handle, tmax) returns true on a hit closer than tmax, which it then shrinks */
+template<bool any_hit, typename LeafFunction>
+static bool traverse(const DynamicBVH& bvh, const Ray& r, Real tmin, Real tmax, LeafFunction intersect_leaf)
+{
+    if (bvh.root_ < 0)
+        return false;
+
+    auto box_entry = [&](const AABB& box, Real t_far) {
+        Real t_near = tmin;
+        const Point3* planes[2] = { &box.min_, &box.max_ };
+        for (int a = 0; a < 3; a++) {
+            int neg = r.dir_is_neg_[a];
+            slab_clip(planes[neg]->e[a], planes[1 - neg]->e[a], r.origin_.e[a], r.inv_direction_.e[a], t_near, t_far);
+        }
+        return t_near < t_far ? t_near : infinity;
+    };
+
+    int stack[DynamicBVH::max_depth + 1];
+    int stack_size = 0;
+    int current = bvh.root_;
+    if (box_entry(bvh.nodes_[current].bounds_, tmax) == infinity)
+        return false;
+
+    bool hit_anything = false;
+
+    while (true) {
+        const DynamicBVHNode& node = bvh.nodes_[current];
+        BVH_STATS_ADD(nodes_visited_, 1);
+
+        if (node.is_leaf()) {
+            BVH_STATS_ADD(primitives_tested_, 1);
+            if (intersect_leaf(node.primitive_, tmax)) {
+                if (any_hit)
+                    return true;
+                hit_anything = true;
+            }
+        } else {
+            /* Children are tested before they are pushed, so that the nearer one is visited first */
+            int first = node.children_[0], second = node.children_[1];
+            auto t_first = box_entry(bvh.nodes_[first].bounds_, tmax);
+            auto t_second = box_entry(bvh.nodes_[second].bounds_, tmax);
+            if (t_second < t_first) {
+                std::swap(first, second);
+                std::swap(t_first, t_second);
+            }
+
+            if (t_first != infinity) {
+                if (t_second != infinity)
+                    stack[stack_size++] = second;
+                current = first;
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+bool DynamicBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool DynamicBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return traverse<false>(*this, r, tmin, tmax, [&](int handle, Real& t_closest) {
+        if (!primitives_[handle]->intersect(r, tmin, t_closest, rec))
+            return false;
+        t_closest = rec.t_;
+        return true;
+    });
+}
+
+bool DynamicBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return traverse<true>(*this, r, tmin, tmax, [&](int handle, Real& t_closest) {
+        return primitives_[handle]->occluded(r, tmin, t_closest);
+    });
+}
+
+bool DynamicBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (root_ < 0)
+        return false;
+
+    output_box = nodes_[root_].bounds_;
+    return true;
+}
@@ -0,0 +1,118 @@
+#ifndef __DynamicBVH_hpp__
+#define __DynamicBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <vector>
+
+/* A node of the dynamic BVH. Leaves hold a single primitive */
+struct DynamicBVHNode {
+    AABB bounds_;
+    /* -1 for the root */
+    int parent_;
+    /* -1 for leaves */
+    int children_[2];
+    /* Leaves: handle of the primitive */
+    int primitive_;
+    /* Longest path to a leaf below, 0 for leaves */
+    int height_;
+
+    bool is_leaf() const {
+        return children_[0] < 0;
+    }
+};
+
+
+/*
+    A BVH that can be edited in place. Objects are inserted next to the sibling that increases the surface
+    area heuristic the least, found with a branch and bound search, and tree rotations keep the quality up
+    along the path to the root. When the cost grows past rebuild_threshold_ times the cost of the last full
+    build, the tree is rebuilt
+*/
+class DynamicBVH : public Hittable {
+public:
+    DynamicBVH(Real time0 = 0, Real time1 = 0, const BVHBuildOptions& options = BVHBuildOptions());
+
+    DynamicBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /* Add object to the tree, returns the handle used to update or remove it */
+    int insert(shared_ptr<Hittable> object);
+
+    void remove(int handle);
+
+    /* Move the object of handle to where its new bounds belong, after it was changed */
+    void update(int handle);
+
+    /* Build the whole tree again from the current objects */
+    void rebuild();
+
+    /* Expected cost of a random ray hitting the tree, based on the surface area heuristic, kept up to date on edits */
+    Real sah_cost() const;
+
+    shared_ptr<Hittable> object(int handle) const {
+        return primitives_[handle];
+    }
+
+    /* Number of objects in the tree */
+    size_t size() const {
+        return n_primitives_;
+    }
+
+    /* Rebuild once the cost exceeds the cost after the last build by this factor. 0 disables the rebuilds */
+    Real rebuild_threshold_ = 1.5;
+
+    /* Maximum depth of the tree, and size of the traversal stack. Deeper trees are rebuilt */
+    static const int max_depth = 64;
+
+public:
+    std::vector<DynamicBVHNode> nodes_;
+    int root_ = -1;
+    /* Objects by handle, null for free handles */
+    std::vector<shared_ptr<Hittable>> primitives_;
+
+private:
+    int allocate_node();
+    void free_node(int index);
+
+    /* Insert the leaf into the tree, next to the best sibling */
+    void insert_leaf(int leaf);
+
+    /* Detach the leaf from the tree, the leaf node itself is kept */
+    void remove_leaf(int leaf);
+
+    /* Refit the ancestors of node up to the root, rotating them on the way */
+    void refit_ancestors(int node);
+
+    /* Swap a child and a grandchild of node, if it reduces the area of the tree */
+    void rotate(int node);
+
+    /* Create the nodes of build_node, returns the index of its root */
+    int convert(const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node, int parent);
+
+    void rebuild_if_degraded();
+
+    Real time0_, time1_;
+    BVHBuildOptions options_;
+    /* Leaf node of every handle */
+    std::vector<int> leaves_;
+    std::vector<int> free_nodes_;
+    std::vector<int> free_handles_;
+    size_t n_primitives_ = 0;
+    /* Sums of the surface areas of the interior nodes and the leaves */
+    Real interior_area_ = 0, leaf_area_ = 0;
+    /* Cost after the last full build */
+    Real built_cost_ = 0;
+};
+
+#endif
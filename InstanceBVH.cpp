@@ -0,0 +1,59 @@
+#include "InstanceBVH.hpp"
+
+InstanceBVH::InstanceBVH(const std::vector<Instance>& instances, const BVHBuildOptions& options)
+{
+    if (instances.empty())
+        return;
+
+    /* Instance bounds are computed once on construction, so they are read directly */
+    std::vector<BVHPrimitiveInfo> prims(instances.size());
+    bounds_ = AABB::empty();
+    for (size_t i = 0; i < instances.size(); i++) {
+        prims[i].index_ = i;
+        prims[i].bounds_ = instances[i].bbox_;
+        prims[i].centroid_ = instances[i].bbox_.centroid();
+        bounds_.expand(instances[i].bbox_);
+    }
+
+    auto root = bvh_build(prims, LinearBVH::build_options(options));
+    linear_bvh_flatten(*root, nodes_);
+
+    instances_.reserve(instances.size());
+    for (const auto& prim : prims)
+        instances_.push_back(instances[prim.index_]);
+}
+
+bool InstanceBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return linear_bvh_traverse(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            /* The type is known, so the call is not dispatched through the vtable */
+            if (instances_[offset + i].Instance::hit(r, tmin, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool InstanceBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (instances_[offset + i].Instance::occluded(r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool InstanceBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (instances_.empty())
+        return false;
+
+    output_box = bounds_;
+    return true;
+}
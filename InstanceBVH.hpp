@@ -0,0 +1,37 @@
+#ifndef __InstanceBVH_hpp__
+#define __InstanceBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/Instance.hpp"
+
+#include <vector>
+
+/*
+    Top level acceleration structure over instances. Each instance holds a transform and a reference
+    to a shared bottom level structure, so the geometry itself is stored once no matter how many times
+    it is placed in the scene
+*/
+class InstanceBVH : public Hittable {
+public:
+    InstanceBVH() {};
+
+    InstanceBVH(const std::vector<Instance>& instances, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+public:
+    std::vector<LinearBVHNode> nodes_;
+    /* Instances stored by value, ordered so that every leaf references a contiguous range */
+    std::vector<Instance> instances_;
+    AABB bounds_;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "LinearBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static uint32_t flatten(const BVHBuildNode& build_node, std::vector<LinearBVHNode>& nodes)
+{
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    if (build_node.is_leaf()) {
+        nodes[index].primitives_offset_ = static_cast<uint32_t>(build_node.start_);
+        nodes[index].n_primitives_ = static_cast<uint16_t>(build_node.end_ - build_node.start_);
+        nodes[index].axis_ = 0;
+    } else {
+        flatten(*build_node.children_[0], nodes);
+        uint32_t second = flatten(*build_node.children_[1], nodes);
+
+        nodes[index].second_child_offset_ = second;
+        nodes[index].n_primitives_ = 0;
+        nodes[index].axis_ = static_cast<uint8_t>(build_node.axis_);
+    }
+
+    linear_bvh_set_bounds(nodes[index], build_node.bounds_);
+    nodes[index].pad_ = 0;
+
+    return index;
+}
+
+void linear_bvh_flatten(const BVHBuildNode& root, std::vector<LinearBVHNode>& nodes)
+{
+    nodes.clear();
+    nodes.reserve(2 * (root.end_ - root.start_));
+    flatten(root, nodes);
+}
+
+BVHBuildOptions LinearBVH::build_options(const BVHBuildOptions& options)
+{
+    BVHBuildOptions build_options = options;
+    build_options.max_leaf_size_ = std::min<size_t>(options.max_leaf_size_, std::numeric_limits<uint16_t>::max());
+    build_options.max_depth_ = options.max_depth_ < max_depth ? options.max_depth_ : max_depth;
+    return build_options;
+}
+
+LinearBVH::LinearBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options)
+{
+    if (list.objects_.empty())
+        return;
+
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+    auto root = bvh_build(prims, build_options(options));
+    linear_bvh_flatten(*root, nodes_);
+
+    primitives_.reserve(prims.size());
+    for (const auto& prim : prims)
+        primitives_.push_back(list.objects_[prim.index_]);
+}
+
+bool LinearBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool LinearBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return linear_bvh_traverse(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->intersect(r, tmin, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool LinearBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->occluded(r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+void LinearBVH::refit(Real time0, Real time1)
+{
+    /* Children are stored after their parent, so going backwards visits them first */
+    for (size_t i = nodes_.size(); i-- > 0;) {
+        LinearBVHNode& node = nodes_[i];
+        AABB box = AABB::empty();
+
+        if (node.n_primitives_ > 0) {
+            for (uint32_t p = 0; p < node.n_primitives_; p++) {
+                AABB primitive_box;
+                if (primitives_[node.primitives_offset_ + p]->bounding_box(time0, time1, primitive_box))
+                    box.expand(primitive_box);
+            }
+        } else {
+            box.expand(linear_bvh_bounds(nodes_[i + 1]));
+            box.expand(linear_bvh_bounds(nodes_[node.second_child_offset_]));
+        }
+
+        linear_bvh_set_bounds(node, box);
+    }
+}
+
+bool LinearBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
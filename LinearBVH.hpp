@@ -0,0 +1,170 @@
+#ifndef __LinearBVH_hpp__
+#define __LinearBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "BVHStats.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+    A node of the flattened BVH. Bounds are stored in single precision, rounded outwards so that no
+    hit is missed. The first child of an interior node is the node right after it in the array
+*/
+struct LinearBVHNode {
+    float bounds_min_[3];
+    float bounds_max_[3];
+    union {
+        /* Leaf: index of the first primitive */
+        uint32_t primitives_offset_;
+        /* Interior: index of the second child */
+        uint32_t second_child_offset_;
+    };
+    /* Number of primitives, 0 for interior nodes */
+    uint16_t n_primitives_;
+    /* Split axis of interior nodes */
+    uint8_t axis_;
+    uint8_t pad_;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+/* Store box in the node, rounded outwards */
+inline void linear_bvh_set_bounds(LinearBVHNode& node, const AABB& box)
+{
+    for (int a = 0; a < 3; a++) {
+        node.bounds_min_[a] = round_down_float(box.min()[a]);
+        node.bounds_max_[a] = round_up_float(box.max()[a]);
+    }
+}
+
+inline AABB linear_bvh_bounds(const LinearBVHNode& node)
+{
+    return AABB(
+        Point3(node.bounds_min_[0], node.bounds_min_[1], node.bounds_min_[2]),
+        Point3(node.bounds_max_[0], node.bounds_max_[1], node.bounds_max_[2]));
+}
+
+/* Slab test against a node, the near and far planes are picked from the sign of the ray direction */
+inline bool linear_bvh_node_hit(const LinearBVHNode& node, const Ray& r, Real tmin, Real tmax)
+{
+    const float* planes[2] = { node.bounds_min_, node.bounds_max_ };
+    for (int a = 0; a < 3; a++) {
+        int neg = r.dir_is_neg_[a];
+        slab_clip(planes[neg][a], planes[1 - neg][a], r.origin_.e[a], r.inv_direction_.e[a], tmin, tmax);
+    }
+    return tmin < tmax;
+}
+
+/*
+    Flatten the build tree into nodes in depth first order. Leaves reference the ranges of the build
+    tree, which are also their ranges in the reordered BVHPrimitiveInfo array
+*/
+void linear_bvh_flatten(const BVHBuildNode& root, std::vector<LinearBVHNode>& nodes);
+
+/*
+    Traverse the nodes with an explicit stack, nearer child first. For every leaf the ray reaches,
+    intersect_leaf(offset, count, tmax) is called, and returns true if it found a hit, closer than
+    tmax, which it then shrinks. Returns true if any leaf reported a hit. With any_hit, it returns at the
+    first leaf that reports one. nodes can be any array, also one mapped from a file
+*/
+template<bool any_hit = false, typename LeafFunction>
+bool linear_bvh_traverse(const LinearBVHNode* nodes, size_t n_nodes, const Ray& r, Real tmin, Real tmax, LeafFunction intersect_leaf);
+
+/*
+    The same traversal over nodes of any type laid out like LinearBVHNode, with bounds of their own.
+    node_hit(node, tmin, tmax) is the test of the ray against the bounds of a node
+*/
+template<bool any_hit = false, typename Node, typename NodeTest, typename LeafFunction>
+bool linear_bvh_traverse(const Node* nodes, size_t n_nodes, const Ray& r, Real tmin, Real tmax, NodeTest node_hit, LeafFunction intersect_leaf);
+
+
+class LinearBVH : public Hittable {
+public:
+    LinearBVH() {};
+
+    LinearBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /* Recompute the node bounds bottom up, for primitives that moved. The tree structure is kept */
+    void refit(Real time0, Real time1);
+
+    /* Maximum depth of the tree, and size of the traversal stack */
+    static const int max_depth = 64;
+
+    /* The options limited to what the node layout and the traversal stack can hold */
+    static BVHBuildOptions build_options(const BVHBuildOptions& options);
+
+public:
+    std::vector<LinearBVHNode> nodes_;
+    /* Primitives ordered so that every leaf references a contiguous range */
+    std::vector<shared_ptr<Hittable>> primitives_;
+};
+
+
+template<bool any_hit, typename LeafFunction>
+bool linear_bvh_traverse(const LinearBVHNode* nodes, size_t n_nodes, const Ray& r, Real tmin, Real tmax, LeafFunction intersect_leaf)
+{
+    return linear_bvh_traverse<any_hit>(nodes, n_nodes, r, tmin, tmax, [&r](const LinearBVHNode& node, Real t0, Real t1) {
+        return linear_bvh_node_hit(node, r, t0, t1);
+    }, intersect_leaf);
+}
+
+template<bool any_hit, typename Node, typename NodeTest, typename LeafFunction>
+bool linear_bvh_traverse(const Node* nodes, size_t n_nodes, const Ray& r, Real tmin, Real tmax, NodeTest node_hit, LeafFunction intersect_leaf)
+{
+    if (n_nodes == 0)
+        return false;
+
+    /* Nodes that still have to be visited */
+    uint32_t stack[LinearBVH::max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const Node& node = nodes[current];
+        BVH_STATS_ADD(nodes_visited_, 1);
+
+        if (node_hit(node, tmin, tmax)) {
+            if (node.n_primitives_ > 0) {
+                BVH_STATS_ADD(primitives_tested_, node.n_primitives_);
+                if (intersect_leaf(node.primitives_offset_, node.n_primitives_, tmax)) {
+                    if (any_hit)
+                        return true;
+                    hit_anything = true;
+                }
+                if (stack_size == 0)
+                    break;
+                current = stack[--stack_size];
+            } else {
+                /* Visit the nearer child first, so that tmax shrinks before the farther one is tested */
+                if (r.dir_is_neg_[node.axis_]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.second_child_offset_;
+                } else {
+                    stack[stack_size++] = node.second_child_offset_;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_anything;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __MappedFile_hpp__
+#define __MappedFile_hpp__
+
+#include <cstddef>
+#include <string>
+
+/* A file mapped read only into memory, unmapped on destruction */
+class MappedFile {
+public:
+    MappedFile() {};
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /* Map the whole file, returns false if it does not exist or can't be mapped */
+    bool open(const std::string& path);
+
+    void close();
+
+    /* Drop the pages of [offset, offset + size) from the memory of the process, they are read again when accessed */
+    void release(size_t offset, size_t size) const;
+
+    const unsigned char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+#endif
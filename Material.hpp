@@ -10,10 +10,17 @@
 struct HitRecord;
 
 struct ScatterRecord {
+    ScatterRecord() {}
+    /* pdf_ can point into the record */
+    ScatterRecord(const ScatterRecord&) = delete;
+    ScatterRecord& operator=(const ScatterRecord&) = delete;
+
     Ray specular_ray_;
     bool is_specular_;
     Color attenuation_;
-    shared_ptr<PDF> pdf_;
+    /* Density of the diffuse directions, kept in the record so that scattering allocates nothing */
+    const PDF* pdf_ = nullptr;
+    CosinePDF cosine_pdf_;
 };
 
 class Material {
@@ -46,7 +53,8 @@ public:
     ) const override {
         srec.is_specular_ = false;
         srec.attenuation_ = albedo_->value(rec.u_, rec.v_, rec.p_);
-        srec.pdf_ = make_shared<CosinePDF>(rec.normal_);
+        srec.cosine_pdf_ = CosinePDF(rec.normal_);
+        srec.pdf_ = &srec.cosine_pdf_;
         return true;
     }
 
@@ -73,7 +81,7 @@ public:
         srec.specular_ray_ = Ray(rec.p_, reflected + fuzziness_ * random_in_unit_sphere());
         srec.attenuation_ = albedo_;
         srec.is_specular_ = true;
-        srec.pdf_ = 0;
+        srec.pdf_ = nullptr;
         return true;
     }
 
@@ -154,10 +162,11 @@ public:
     Isotropic(shared_ptr<Texture> a) : albedo_(a) {}
 
     virtual bool scatter(const Ray& r_in, const HitRecord& rec, ScatterRecord& srec) const override {
-        /* scatter in a random direction */
+        /* scatter in a random direction, the uniform density cancels with the phase function so there is no pdf */
+        srec.specular_ray_ = Ray(rec.p_, random_unit_vector(), r_in.Time());
         srec.is_specular_ = false;
         srec.attenuation_ = albedo_->value(rec.u_, rec.v_, rec.p_);
-        srec.pdf_ = 0;
+        srec.pdf_ = nullptr;
         return true;
     }
 
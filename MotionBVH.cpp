@@ -0,0 +1,146 @@
+#include "MotionBVH.hpp"
+#include "LinearBVH.hpp"
+
+/* Slab test against the node bounds, interpolated at u between the two time keys */
+static inline bool node_hit(const MotionBVHNode& node, Real u, const Ray& r, Real tmin, Real tmax)
+{
+    for (int a = 0; a < 3; a++) {
+        Real planes[2] = {
+            (1 - u) * node.bounds_min_[0][a] + u * node.bounds_min_[1][a],
+            (1 - u) * node.bounds_max_[0][a] + u * node.bounds_max_[1][a]
+        };
+        int neg = r.dir_is_neg_[a];
+        slab_clip(planes[neg], planes[1 - neg], r.origin_.e[a], r.inv_direction_.e[a], tmin, tmax);
+    }
+    return tmin < tmax;
+}
+
+MotionBVH::MotionBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options) : time0_(time0), time1_(time1)
+{
+    if (list.objects_.empty())
+        return;
+
+    /*
+        The structure is built over the bounds of the whole motion, the keys are then filled by the refit. The
+        refit can't keep the clipped bounds of spatial splits, so they are built as plain SAH splits
+    */
+    auto build_options = LinearBVH::build_options(options);
+    if (build_options.split_method_ == BVHSplitMethod::SBVH)
+        build_options.split_method_ = BVHSplitMethod::SAH;
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+    auto root = bvh_build(prims, build_options);
+
+    std::vector<LinearBVHNode> linear_nodes;
+    linear_bvh_flatten(*root, linear_nodes);
+
+    nodes_.resize(linear_nodes.size());
+    for (size_t i = 0; i < linear_nodes.size(); i++) {
+        nodes_[i].primitives_offset_ = linear_nodes[i].primitives_offset_;
+        nodes_[i].n_primitives_ = linear_nodes[i].n_primitives_;
+        nodes_[i].axis_ = linear_nodes[i].axis_;
+        nodes_[i].pad_ = 0;
+    }
+
+    primitives_.reserve(prims.size());
+    for (const auto& prim : prims)
+        primitives_.push_back(list.objects_[prim.index_]);
+
+    refit();
+}
+
+void MotionBVH::refit()
+{
+    const Real keys[2] = { time0_, time1_ };
+
+    /* Children are stored after their parent, so going backwards visits them first */
+    for (size_t i = nodes_.size(); i-- > 0;) {
+        MotionBVHNode& node = nodes_[i];
+
+        for (int k = 0; k < 2; k++) {
+            AABB box = AABB::empty();
+
+            if (node.n_primitives_ > 0) {
+                for (uint32_t p = 0; p < node.n_primitives_; p++) {
+                    AABB primitive_box;
+                    if (primitives_[node.primitives_offset_ + p]->bounding_box(keys[k], keys[k], primitive_box))
+                        box.expand(primitive_box);
+                }
+            } else {
+                for (const auto& child : { nodes_[i + 1], nodes_[node.second_child_offset_] }) {
+                    box.expand(AABB(
+                        Point3(child.bounds_min_[k][0], child.bounds_min_[k][1], child.bounds_min_[k][2]),
+                        Point3(child.bounds_max_[k][0], child.bounds_max_[k][1], child.bounds_max_[k][2])));
+                }
+            }
+
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min_[k][a] = round_down_float(box.min()[a]);
+                node.bounds_max_[k][a] = round_up_float(box.max()[a]);
+            }
+        }
+    }
+}
+
+/*
+    linear_bvh_traverse with the node bounds interpolated to the time of the ray. intersect_leaf(offset, count, tmax)
+    returns true if it found a hit closer than tmax, which it then shrinks
+*/
+template<bool any_hit, typename LeafFunction>
+static bool traverse(const MotionBVH& bvh, const Ray& r, Real tmin, Real tmax, LeafFunction intersect_leaf)
+{
+    /* Interpolation factor between the keys, rays outside the keys use the bounds of the nearest one */
+    Real u = (bvh.time1_ > bvh.time0_) ? clamp((r.Time() - bvh.time0_) / (bvh.time1_ - bvh.time0_), 0, 1) : 0;
+
+    return linear_bvh_traverse<any_hit>(bvh.nodes_.data(), bvh.nodes_.size(), r, tmin, tmax, [&r, u](const MotionBVHNode& node, Real t0, Real t1) {
+        return node_hit(node, u, r, t0, t1);
+    }, intersect_leaf);
+}
+
+bool MotionBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool MotionBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return traverse<false>(*this, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->intersect(r, tmin, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool MotionBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return traverse<true>(*this, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->occluded(r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool MotionBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    const MotionBVHNode& root = nodes_[0];
+    output_box = AABB::empty();
+    for (int k = 0; k < 2; k++) {
+        output_box.expand(AABB(
+            Point3(root.bounds_min_[k][0], root.bounds_min_[k][1], root.bounds_min_[k][2]),
+            Point3(root.bounds_max_[k][0], root.bounds_max_[k][1], root.bounds_max_[k][2])));
+    }
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef __MotionBVH_hpp__
+#define __MotionBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+    A node of the motion BVH. Bounds are kept at the two time keys of the tree, and are interpolated to
+    the time of the ray during traversal, instead of covering the whole motion
+*/
+struct MotionBVHNode {
+    float bounds_min_[2][3];
+    float bounds_max_[2][3];
+    union {
+        /* Leaf: index of the first primitive */
+        uint32_t primitives_offset_;
+        /* Interior: index of the second child */
+        uint32_t second_child_offset_;
+    };
+    /* Number of primitives, 0 for interior nodes */
+    uint16_t n_primitives_;
+    /* Split axis of interior nodes */
+    uint8_t axis_;
+    uint8_t pad_;
+};
+
+static_assert(sizeof(MotionBVHNode) == 56, "MotionBVHNode should be 56 bytes");
+
+
+class MotionBVH : public Hittable {
+public:
+    MotionBVH() {};
+
+    MotionBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /*
+        Recompute the bounds at both time keys bottom up, for primitives that moved. The tree structure is kept.
+        The interpolated bounds are conservative for primitives that move linearly between the keys
+    */
+    void refit();
+
+public:
+    std::vector<MotionBVHNode> nodes_;
+    /* Primitives ordered so that every leaf references a contiguous range */
+    std::vector<shared_ptr<Hittable>> primitives_;
+    /* The time keys */
+    Real time0_ = 0, time1_ = 0;
+};
+
+#endif
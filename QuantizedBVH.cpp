@@ -0,0 +1,301 @@
+#include "QuantizedBVH.hpp"
+#include "BVHStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/* 2^e, built from the bits of the double */
+static inline double exp2_int(int e)
+{
+    uint64_t bits = static_cast<uint64_t>(e + 1023) << 52;
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+/* Position of grid coordinate q. The traversal decodes planes with the same expression, so the checks of the build hold */
+static inline double decode(double origin, double step, uint32_t q)
+{
+    return origin + q * step;
+}
+
+/* Only the root has index 0, so an interior slot never has a zero offset */
+template<typename Q>
+static inline bool empty_slot(const QuantizedBVHNode<Q>& node, int c)
+{
+    return node.n_primitives_[c] == 0 && node.offset_[c] == 0;
+}
+
+/* Set the grid of node over box, and store the children bounds on it, rounded outwards */
+template<typename Q>
+static void quantize(QuantizedBVHNode<Q>& node, const AABB& box, const BVHBuildNode* children[], int n_children)
+{
+    const uint32_t max_q = QuantizedBVH<Q>::max_coordinate;
+
+    for (int a = 0; a < 3; a++) {
+        double origin = round_down_float(box.min()[a]);
+        node.origin_[a] = static_cast<float>(origin);
+
+        /* Smallest power of two step for which the grid covers the box */
+        double extent = box.max()[a] - origin;
+        int e = 0;
+        if (extent > 0) {
+            int p;
+            double m = std::frexp(extent / max_q, &p);
+            e = m > 0.5 ? p : p - 1;
+        }
+        e = clamp(e, -126, 126);
+        while (e < 126 && decode(origin, exp2_int(e), max_q) < box.max()[a])
+            e++;
+        node.exponent_[a] = static_cast<int8_t>(e);
+        double step = exp2_int(e);
+
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            if (c >= n_children) {
+                node.bounds_min_[a][c] = static_cast<Q>(max_q);
+                node.bounds_max_[a][c] = 0;
+                continue;
+            }
+
+            const AABB& child = children[c]->bounds_;
+            double lo = std::floor((child.min()[a] - origin) / step);
+            double hi = std::ceil((child.max()[a] - origin) / step);
+            uint32_t q_min = static_cast<uint32_t>(clamp(lo, 0, max_q));
+            uint32_t q_max = static_cast<uint32_t>(clamp(hi, 0, max_q));
+
+            /* The subtraction and the division can round, fix the coordinates so the decoded bounds contain the child */
+            while (q_min > 0 && decode(origin, step, q_min) > child.min()[a])
+                q_min--;
+            while (q_max < max_q && decode(origin, step, q_max) < child.max()[a])
+                q_max++;
+
+            node.bounds_min_[a][c] = static_cast<Q>(q_min);
+            node.bounds_max_[a][c] = static_cast<Q>(q_max);
+        }
+    }
+    node.pad_ = 0;
+}
+
+template<typename Q>
+QuantizedBVH<Q>::QuantizedBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options)
+{
+    if (list.objects_.empty())
+        return;
+
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+
+    /* Leaf sizes have to fit in the node, and the depth in the traversal stack, like for the linear layout */
+    BVHBuildOptions build_options = LinearBVH::build_options(options);
+
+    auto root = bvh_build(prims, build_options);
+    bounds_ = root->bounds_;
+
+    nodes_.reserve(prims.size() / (BVH_WIDTH - 1) + 1);
+    primitives_.reserve(prims.size());
+    collapse(list.objects_, prims, *root);
+}
+
+template<typename Q>
+uint32_t QuantizedBVH<Q>::collapse(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node)
+{
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+
+    const BVHBuildNode* children[BVH_WIDTH];
+    int n_children = bvh_collapse_children(build_node, BVH_WIDTH, children);
+    quantize(nodes_[index], build_node.bounds_, children, n_children);
+
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        if (c >= n_children) {
+            nodes_[index].offset_[c] = 0;
+            nodes_[index].n_primitives_[c] = 0;
+            continue;
+        }
+
+        const BVHBuildNode* child = children[c];
+        if (child->is_leaf()) {
+            nodes_[index].offset_[c] = static_cast<uint32_t>(primitives_.size());
+            nodes_[index].n_primitives_[c] = static_cast<uint16_t>(child->end_ - child->start_);
+            for (size_t i = child->start_; i < child->end_; i++)
+                primitives_.push_back(src_objects[prims[i].index_]);
+        } else {
+            nodes_[index].n_primitives_[c] = 0;
+            /* nodes_ may grow while collapsing the child, so the node is looked up again after */
+            uint32_t child_index = collapse(src_objects, prims, *child);
+            nodes_[index].offset_[c] = child_index;
+        }
+    }
+
+    return index;
+}
+
+/*
+    Decode the child bounds of the node and test the ray against them. Returns a mask with a bit set for
+    every child hit, and stores the entry distances in t_entry
+*/
+template<typename Q>
+static inline unsigned node_hit(const QuantizedBVHNode<Q>& node, const Ray& r, Real tmin, Real tmax, Real t_entry[BVH_WIDTH])
+{
+    Real t_near[BVH_WIDTH], t_far[BVH_WIDTH];
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        t_near[c] = tmin;
+        t_far[c] = tmax;
+    }
+
+    for (int a = 0; a < 3; a++) {
+        double grid_origin = node.origin_[a];
+        double step = exp2_int(node.exponent_[a]);
+        const Q* planes[2] = { node.bounds_min_[a], node.bounds_max_[a] };
+        int neg = r.dir_is_neg_[a];
+        const Q* near_planes = planes[neg];
+        const Q* far_planes = planes[1 - neg];
+
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            slab_clip(decode(grid_origin, step, near_planes[c]), decode(grid_origin, step, far_planes[c]),
+                r.origin_.e[a], r.inv_direction_.e[a], t_near[c], t_far[c]);
+        }
+    }
+
+    unsigned mask = 0;
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        t_entry[c] = t_near[c];
+        if (t_near[c] < t_far[c] && !empty_slot(node, c))
+            mask |= 1u << c;
+    }
+    return mask;
+}
+
+/*
+    Traverse the nodes nearest child first, like WideBVH. intersect_leaf(offset, count, tmax) returns true if
+    it found a hit closer than tmax, which it then shrinks. With any_hit, it returns at the first hit
+*/
+template<bool any_hit, typename Q, typename LeafFunction>
+static bool traverse(const QuantizedBVH<Q>& bvh, const Ray& r, Real tmin, Real tmax, LeafFunction intersect_leaf)
+{
+    if (bvh.nodes_.empty())
+        return false;
+
+    /* Nodes that still have to be visited, with the distance the ray enters them */
+    struct StackEntry {
+        uint32_t node_;
+        Real t_entry_;
+    };
+    StackEntry stack[QuantizedBVH<Q>::max_depth * BVH_WIDTH];
+    int stack_size = 0;
+    stack[stack_size++] = { 0, tmin };
+
+    bool hit_anything = false;
+    Real t_entry[BVH_WIDTH];
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        /* A closer hit was found after the node was pushed */
+        if (entry.t_entry_ >= tmax)
+            continue;
+
+        const QuantizedBVHNode<Q>& node = bvh.nodes_[entry.node_];
+        BVH_STATS_ADD(nodes_visited_, 1);
+        unsigned mask = node_hit(node, r, tmin, tmax, t_entry);
+        if (!mask)
+            continue;
+
+        /* Order the children hit by entry distance */
+        int order[BVH_WIDTH];
+        int n_hit = 0;
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            if (!(mask & (1u << c)))
+                continue;
+            int i = n_hit++;
+            while (i > 0 && t_entry[order[i - 1]] > t_entry[c]) {
+                order[i] = order[i - 1];
+                i--;
+            }
+            order[i] = c;
+        }
+
+        /* Leaves are intersected right away, nearest first, so that tmax shrinks early */
+        for (int i = 0; i < n_hit; i++) {
+            int c = order[i];
+            if (node.n_primitives_[c] == 0 || t_entry[c] >= tmax)
+                continue;
+            BVH_STATS_ADD(primitives_tested_, node.n_primitives_[c]);
+            if (intersect_leaf(node.offset_[c], node.n_primitives_[c], tmax)) {
+                if (any_hit)
+                    return true;
+                hit_anything = true;
+            }
+        }
+
+        /* Interior children are pushed farthest first, so the nearest one is visited next */
+        for (int i = n_hit - 1; i >= 0; i--) {
+            int c = order[i];
+            if (node.n_primitives_[c] == 0 && t_entry[c] < tmax)
+                stack[stack_size++] = { node.offset_[c], t_entry[c] };
+        }
+    }
+
+    return hit_anything;
+}
+
+template<typename Q>
+bool QuantizedBVH<Q>::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+template<typename Q>
+bool QuantizedBVH<Q>::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return traverse<false>(*this, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->intersect(r, tmin, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+template<typename Q>
+bool QuantizedBVH<Q>::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return traverse<true>(*this, r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (primitives_[offset + i]->occluded(r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+template<typename Q>
+AABB QuantizedBVH<Q>::child_bounds(const QuantizedBVHNode<Q>& node, int c)
+{
+    AABB box;
+    for (int a = 0; a < 3; a++) {
+        double step = exp2_int(node.exponent_[a]);
+        box.min_.e[a] = decode(node.origin_[a], step, node.bounds_min_[a][c]);
+        box.max_.e[a] = decode(node.origin_[a], step, node.bounds_max_[a][c]);
+    }
+    return box;
+}
+
+template<typename Q>
+bool QuantizedBVH<Q>::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = bounds_;
+    return true;
+}
+
+template class QuantizedBVH<uint8_t>;
+template class QuantizedBVH<uint16_t>;
@@ -0,0 +1,77 @@
+#ifndef __QuantizedBVH_hpp__
+#define __QuantizedBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "WideBVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/*
+    A node with BVH_WIDTH children, whose bounds are quantized to the integer type Q on a grid over the
+    node's own bounds. The grid starts at origin_, and its step along each axis is a power of two, so decoding
+    a plane is exact. Child bounds are rounded outwards to the grid, and empty slots have inverted bounds
+*/
+template<typename Q>
+struct QuantizedBVHNode {
+    float origin_[3];
+    /* Exponent of the grid step per axis */
+    int8_t exponent_[3];
+    uint8_t pad_;
+    Q bounds_min_[3][BVH_WIDTH];
+    Q bounds_max_[3][BVH_WIDTH];
+    /* Interior child: index of its node. Leaf child: index of its first primitive */
+    uint32_t offset_[BVH_WIDTH];
+    /* Number of primitives of leaf children, 0 for interior children and empty slots */
+    uint16_t n_primitives_[BVH_WIDTH];
+};
+
+
+/*
+    A wide BVH with quantized nodes, a fraction of the size of WideBVH nodes, so that more of the tree stays
+    in the caches. The child bounds are decoded during the traversal
+*/
+template<typename Q>
+class QuantizedBVH : public Hittable {
+public:
+    QuantizedBVH() {};
+
+    QuantizedBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /* Decoded bounds of child slot c of node */
+    static AABB child_bounds(const QuantizedBVHNode<Q>& node, int c);
+
+    /* Maximum depth of the binary tree the nodes are collapsed from */
+    static const int max_depth = LinearBVH::max_depth;
+
+    /* Largest grid coordinate */
+    static const uint32_t max_coordinate = std::numeric_limits<Q>::max();
+
+public:
+    std::vector<QuantizedBVHNode<Q>> nodes_;
+    /* Primitives ordered so that every leaf references a contiguous range */
+    std::vector<shared_ptr<Hittable>> primitives_;
+    AABB bounds_;
+
+private:
+    /* Collapse the binary subtree of build_node into quantized nodes, returns the index of its root node */
+    uint32_t collapse(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node);
+};
+
+typedef QuantizedBVH<uint8_t> QuantizedBVH8;
+typedef QuantizedBVH<uint16_t> QuantizedBVH16;
+
+#endif
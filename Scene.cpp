@@ -0,0 +1,220 @@
+#include "Scene.hpp"
+#include "Material.hpp"
+
+#include "geometry/Instance.hpp"
+#include "geometry/SphereBatch.hpp"
+#include "geometry/QuadBatch.hpp"
+#include "geometry/SDF.hpp"
+
+#include <typeinfo>
+#include <unordered_set>
+
+CompiledScene::CompiledScene(const HittableList& primitives, std::vector<shared_ptr<Material>> materials, shared_ptr<Hittable> lights,
+    Real time0, Real time1, const BVHBuildOptions& options)
+    : accel_(primitives, time0, time1, options), materials_(std::move(materials)), lights_(lights), n_primitives_(primitives.objects_.size())
+{
+}
+
+/* The offset of a transform that only translates, returns false for anything else */
+static bool translation_of(const Transform& transform, Vector3& offset)
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (transform.m_[i][j] != (i == j ? 1 : 0))
+                return false;
+        }
+    }
+    offset = Vector3(transform.m_[0][3], transform.m_[1][3], transform.m_[2][3]);
+    return true;
+}
+
+/* The walk over the authoring graph, collecting the primitives, their materials and the emitters */
+class SceneFlattener {
+public:
+    void flatten(const shared_ptr<Hittable>& object, const Transform& transform, bool flip);
+
+public:
+    std::vector<shared_ptr<Hittable>> primitives_;
+    std::vector<shared_ptr<Material>> materials_;
+    HittableList emitters_;
+
+private:
+    /* The object moved by transform, as a primitive of its own type if it can be, or as an instance */
+    shared_ptr<Hittable> place(const shared_ptr<Hittable>& object, const Transform& transform) const;
+
+    void add_materials(const Hittable& object);
+    void add_material(const shared_ptr<Material>& mat);
+
+    /* The materials of the primitives in the graph under object, which is kept as it is */
+    void add_materials_below(const Hittable& object);
+
+    std::unordered_set<const Material*> seen_;
+    /* The graphs already walked by add_materials_below, shared ones are walked once */
+    std::unordered_set<const Hittable*> walked_;
+};
+
+void SceneFlattener::flatten(const shared_ptr<Hittable>& object, const Transform& transform, bool flip)
+{
+    if (!object)
+        return;
+
+    /* The nodes of the graph are dissolved, only the primitives under them are kept */
+    const Hittable* node = object.get();
+    if (auto list = dynamic_cast<const HittableList*>(node)) {
+        for (const auto& child : list->objects_)
+            flatten(child, transform, flip);
+        return;
+    }
+    if (auto bvh = dynamic_cast<const BVHNode*>(node)) {
+        flatten(bvh->left, transform, flip);
+        flatten(bvh->right, transform, flip);
+        return;
+    }
+    if (auto instance = dynamic_cast<const Instance*>(node)) {
+        Transform combined = transform * instance->transform_;
+        Vector3 offset;
+        if (translation_of(combined, offset)) {
+            flatten(instance->object_, combined, flip);
+            return;
+        }
+
+        /* Flattening would copy the object once per instance, it stays shared under a single instance */
+        add_materials_below(*instance->object_);
+        shared_ptr<Hittable> placed = make_shared<Instance>(instance->object_, combined);
+        if (flip)
+            placed = make_shared<FlipFace>(placed);
+        primitives_.push_back(placed);
+        return;
+    }
+    if (auto flipped = dynamic_cast<const FlipFace*>(node)) {
+        flatten(flipped->ptr_, transform, !flip);
+        return;
+    }
+
+    add_materials(*object);
+    auto placed = place(object, transform);
+
+    /* The emitters that can be sampled, whichever way they face */
+    const std::type_info& type = typeid(*placed);
+    if (type == typeid(Sphere) && dynamic_cast<const DiffuseLight*>(static_cast<const Sphere&>(*placed).mat_.get()))
+        emitters_.add(placed);
+    if (type == typeid(XZRect) && dynamic_cast<const DiffuseLight*>(static_cast<const XZRect&>(*placed).mat_.get()))
+        emitters_.add(placed);
+
+    if (flip)
+        placed = make_shared<FlipFace>(placed);
+    primitives_.push_back(placed);
+}
+
+shared_ptr<Hittable> SceneFlattener::place(const shared_ptr<Hittable>& object, const Transform& transform) const
+{
+    Vector3 offset;
+    if (!translation_of(transform, offset))
+        return make_shared<Instance>(object, transform);
+    if (offset.length_squared() == 0)
+        return object;
+
+    /* Only exact types, a subclass could hold more than the copy would */
+    const std::type_info& type = typeid(*object);
+    if (type == typeid(Sphere)) {
+        const auto& s = static_cast<const Sphere&>(*object);
+        return make_shared<Sphere>(s.center_ + offset, s.radius_, s.mat_);
+    }
+    if (type == typeid(MovingSphere)) {
+        const auto& s = static_cast<const MovingSphere&>(*object);
+        return make_shared<MovingSphere>(s.center0_ + offset, s.center1_ + offset, s.time0_, s.time1_, s.radius_, s.mat_);
+    }
+    if (type == typeid(XYRect)) {
+        const auto& q = static_cast<const XYRect&>(*object);
+        return make_shared<XYRect>(q.x0_ + offset.x(), q.x1_ + offset.x(), q.y0_ + offset.y(), q.y1_ + offset.y(), q.k_ + offset.z(), q.mat_);
+    }
+    if (type == typeid(XZRect)) {
+        const auto& q = static_cast<const XZRect&>(*object);
+        return make_shared<XZRect>(q.x0_ + offset.x(), q.x1_ + offset.x(), q.z0_ + offset.z(), q.z1_ + offset.z(), q.k_ + offset.y(), q.mat_);
+    }
+    if (type == typeid(YZRect)) {
+        const auto& q = static_cast<const YZRect&>(*object);
+        return make_shared<YZRect>(q.y0_ + offset.y(), q.y1_ + offset.y(), q.z0_ + offset.z(), q.z1_ + offset.z(), q.k_ + offset.x(), q.mat_);
+    }
+    if (type == typeid(Box)) {
+        const auto& b = static_cast<const Box&>(*object);
+        return make_shared<Box>(b.box_min_ + offset, b.box_max_ + offset, b.mat_);
+    }
+
+    return make_shared<Instance>(object, transform);
+}
+
+void SceneFlattener::add_materials(const Hittable& object)
+{
+    /* Structures built before compilation, like the BLAS of instances, are not looked into */
+    if (auto s = dynamic_cast<const Sphere*>(&object))
+        add_material(s->mat_);
+    else if (auto s = dynamic_cast<const MovingSphere*>(&object))
+        add_material(s->mat_);
+    else if (auto q = dynamic_cast<const XYRect*>(&object))
+        add_material(q->mat_);
+    else if (auto q = dynamic_cast<const XZRect*>(&object))
+        add_material(q->mat_);
+    else if (auto q = dynamic_cast<const YZRect*>(&object))
+        add_material(q->mat_);
+    else if (auto b = dynamic_cast<const Box*>(&object))
+        add_material(b->mat_);
+    else if (auto mesh = dynamic_cast<const TriangleMesh*>(&object))
+        add_material(mesh->mat_);
+    else if (auto sdf = dynamic_cast<const SDFObject*>(&object))
+        add_material(sdf->mat_);
+    else if (auto medium = dynamic_cast<const ConstantMedium*>(&object)) {
+        add_material(medium->phase_function_);
+        add_materials(*medium->boundary_);
+    } else if (auto batch = dynamic_cast<const SphereBatch*>(&object)) {
+        for (const auto& mat : batch->materials_)
+            add_material(mat);
+    } else if (auto batch = dynamic_cast<const QuadBatch*>(&object)) {
+        for (const auto& mat : batch->materials_)
+            add_material(mat);
+    }
+}
+
+void SceneFlattener::add_materials_below(const Hittable& object)
+{
+    if (!walked_.insert(&object).second)
+        return;
+
+    if (auto list = dynamic_cast<const HittableList*>(&object)) {
+        for (const auto& child : list->objects_)
+            add_materials_below(*child);
+    } else if (auto bvh = dynamic_cast<const BVHNode*>(&object)) {
+        if (bvh->left)
+            add_materials_below(*bvh->left);
+        if (bvh->right)
+            add_materials_below(*bvh->right);
+    } else if (auto instance = dynamic_cast<const Instance*>(&object)) {
+        add_materials_below(*instance->object_);
+    } else if (auto flipped = dynamic_cast<const FlipFace*>(&object)) {
+        add_materials_below(*flipped->ptr_);
+    } else {
+        add_materials(object);
+    }
+}
+
+void SceneFlattener::add_material(const shared_ptr<Material>& mat)
+{
+    if (mat && seen_.insert(mat.get()).second)
+        materials_.push_back(mat);
+}
+
+shared_ptr<CompiledScene> Scene::compile(Real time0, Real time1, const BVHBuildOptions& options) const
+{
+    SceneFlattener flattener;
+    for (const auto& object : world_.objects_)
+        flattener.flatten(object, Transform(), false);
+
+    HittableList primitives;
+    primitives.objects_ = std::move(flattener.primitives_);
+
+    shared_ptr<Hittable> lights = lights_;
+    if (!lights && !flattener.emitters_.objects_.empty())
+        lights = make_shared<HittableList>(flattener.emitters_);
+
+    return make_shared<CompiledScene>(primitives, std::move(flattener.materials_), lights, time0, time1, options);
+}
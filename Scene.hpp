@@ -0,0 +1,84 @@
+#ifndef __Scene_hpp__
+#define __Scene_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "TypedBVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <vector>
+
+/*
+    A scene ready to be rendered: the primitives in arrays per type under a single tree, the table of every
+    material they use, and the objects to sample as lights. It owns all of them, the authoring graph it was
+    compiled from can be dropped
+*/
+class CompiledScene : public Hittable {
+public:
+    CompiledScene(const HittableList& primitives, std::vector<shared_ptr<Material>> materials, shared_ptr<Hittable> lights,
+        Real time0, Real time1, const BVHBuildOptions& options);
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override {
+        return accel_.TypedBVH::hit(r, tmin, tmax, rec);
+    }
+
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override {
+        return accel_.TypedBVH::intersect(r, tmin, tmax, rec);
+    }
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override {
+        return accel_.bounding_box(t0, t1, output_box);
+    }
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override {
+        return accel_.TypedBVH::occluded(r, tmin, tmax);
+    }
+
+    virtual bool has_random_hits() const override {
+        return accel_.has_random_hits();
+    }
+
+    size_t primitive_count() const {
+        return n_primitives_;
+    }
+
+    /*
+        The lights given to Scene, or else the emitters compile found. Null if the scene has nothing to sample.
+        Only the emitting spheres and XZ rectangles moved by translations at most are found: an emitter under
+        any other transform, or inside a batch, a mesh or a tree built before compilation, is rendered but
+        never sampled, and such scenes should pass their lights to Scene
+    */
+    shared_ptr<Hittable> lights() const {
+        return lights_;
+    }
+
+public:
+    TypedBVH accel_;
+    /* Every material of the primitives, once */
+    std::vector<shared_ptr<Material>> materials_;
+    shared_ptr<Hittable> lights_;
+    size_t n_primitives_ = 0;
+};
+
+
+/*
+    A scene as it is written: a graph of lists, BVH nodes, instances and flipped faces over the primitives, and
+    the objects to sample as lights. compile flattens the graph. Translations are baked into the spheres,
+    rectangles and boxes. An instance with any other transform stays a single primitive over its object, which
+    is not flattened, so the trees shared by instances are not copied. Without lights, the emitting
+    spheres and XZ rectangles of the scene are sampled, see CompiledScene::lights for the emitters it misses
+*/
+class Scene {
+public:
+    Scene(const HittableList& world, shared_ptr<Hittable> lights = nullptr) : world_(world), lights_(lights) {}
+
+    shared_ptr<CompiledScene> compile(Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions()) const;
+
+public:
+    HittableList world_;
+    shared_ptr<Hittable> lights_;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "TypedBVH.hpp"
+
+#include <typeinfo>
+
+/* The type an object is stored as. Only exact types are stored by value, a subclass could override anything */
+static TypedPrimitive primitive_type(const Hittable& object)
+{
+    const std::type_info& type = typeid(object);
+    if (type == typeid(Sphere))
+        return TypedPrimitive::sphere;
+    if (type == typeid(MovingSphere))
+        return TypedPrimitive::moving_sphere;
+    if (type == typeid(XYRect))
+        return TypedPrimitive::xy_rect;
+    if (type == typeid(XZRect))
+        return TypedPrimitive::xz_rect;
+    if (type == typeid(YZRect))
+        return TypedPrimitive::yz_rect;
+    if (type == typeid(Box))
+        return TypedPrimitive::box;
+    if (type == typeid(TriangleMesh))
+        return TypedPrimitive::mesh;
+    if (type == typeid(ConstantMedium))
+        return TypedPrimitive::medium;
+    return TypedPrimitive::other;
+}
+
+TypedBVH::TypedBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options)
+{
+    if (list.objects_.empty())
+        return;
+
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+    auto root = bvh_build(prims, LinearBVH::build_options(options));
+    linear_bvh_flatten(*root, nodes_);
+
+    std::vector<TypedPrimitive> types(list.objects_.size());
+    for (size_t i = 0; i < list.objects_.size(); i++) {
+        types[i] = primitive_type(*list.objects_[i]);
+        random_hits_ |= list.objects_[i]->has_random_hits();
+    }
+
+    /* Split every leaf into a range per type, appending its primitives to the array of their type */
+    const int n_types = static_cast<int>(TypedPrimitive::other) + 1;
+    for (auto& node : nodes_) {
+        if (node.n_primitives_ == 0)
+            continue;
+
+        uint32_t first = node.primitives_offset_;
+        uint32_t end = first + node.n_primitives_;
+        node.primitives_offset_ = static_cast<uint32_t>(ranges_.size());
+        node.n_primitives_ = 0;
+
+        for (int t = 0; t < n_types; t++) {
+            TypedPrimitive type = static_cast<TypedPrimitive>(t);
+            TypedRange range = { 0, 0, type };
+
+            for (uint32_t i = first; i < end; i++) {
+                size_t index = prims[i].index_;
+                if (types[index] != type)
+                    continue;
+
+                const auto& object = list.objects_[index];
+                uint32_t offset = 0;
+                switch (type) {
+                case TypedPrimitive::sphere:
+                    offset = static_cast<uint32_t>(spheres_.size());
+                    spheres_.push_back(static_cast<const Sphere&>(*object));
+                    break;
+                case TypedPrimitive::moving_sphere:
+                    offset = static_cast<uint32_t>(moving_spheres_.size());
+                    moving_spheres_.push_back(static_cast<const MovingSphere&>(*object));
+                    break;
+                case TypedPrimitive::xy_rect:
+                    offset = static_cast<uint32_t>(xy_rects_.size());
+                    xy_rects_.push_back(static_cast<const XYRect&>(*object));
+                    break;
+                case TypedPrimitive::xz_rect:
+                    offset = static_cast<uint32_t>(xz_rects_.size());
+                    xz_rects_.push_back(static_cast<const XZRect&>(*object));
+                    break;
+                case TypedPrimitive::yz_rect:
+                    offset = static_cast<uint32_t>(yz_rects_.size());
+                    yz_rects_.push_back(static_cast<const YZRect&>(*object));
+                    break;
+                case TypedPrimitive::box:
+                    offset = static_cast<uint32_t>(boxes_.size());
+                    boxes_.push_back(static_cast<const Box&>(*object));
+                    break;
+                case TypedPrimitive::mesh:
+                    offset = static_cast<uint32_t>(meshes_.size());
+                    meshes_.push_back(std::static_pointer_cast<TriangleMesh>(object));
+                    break;
+                case TypedPrimitive::medium:
+                    offset = static_cast<uint32_t>(media_.size());
+                    media_.push_back(std::static_pointer_cast<ConstantMedium>(object));
+                    break;
+                case TypedPrimitive::other:
+                    offset = static_cast<uint32_t>(others_.size());
+                    others_.push_back(object);
+                    break;
+                }
+
+                if (range.count_ == 0)
+                    range.offset_ = offset;
+                range.count_++;
+            }
+
+            if (range.count_ > 0) {
+                ranges_.push_back(range);
+                node.n_primitives_++;
+            }
+        }
+    }
+}
+
+/*
+    Test the objects of a range in order, shrinking t_closest on every hit. intersect(i) tests object i of the
+    array of the range type up to t_closest
+*/
+template<typename Intersect>
+static inline bool intersect_each(const TypedRange& range, Real& t_closest, HitRecord& rec, Intersect intersect)
+{
+    bool hit_anything = false;
+    for (uint32_t i = range.offset_; i < range.offset_ + range.count_; i++) {
+        if (intersect(i)) {
+            hit_anything = true;
+            t_closest = rec.t_;
+        }
+    }
+    return hit_anything;
+}
+
+template<typename Occluded>
+static inline bool occluded_any(const TypedRange& range, Occluded occluded)
+{
+    for (uint32_t i = range.offset_; i < range.offset_ + range.count_; i++) {
+        if (occluded(i))
+            return true;
+    }
+    return false;
+}
+
+bool TypedBVH::range_intersect(const TypedRange& range, const Ray& r, Real tmin, Real& t_closest, HitRecord& rec) const
+{
+    /* The calls are qualified, so they are not dispatched through the vtable */
+    switch (range.type_) {
+    case TypedPrimitive::sphere:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return spheres_[i].Sphere::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::moving_sphere:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return moving_spheres_[i].MovingSphere::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::xy_rect:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return xy_rects_[i].XYRect::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::xz_rect:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return xz_rects_[i].XZRect::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::yz_rect:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return yz_rects_[i].YZRect::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::box:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return boxes_[i].Box::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::mesh:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return meshes_[i]->TriangleMesh::intersect(r, tmin, t_closest, rec); });
+    case TypedPrimitive::medium:
+        /* Media fill the whole record */
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) {
+            if (!media_[i]->ConstantMedium::hit(r, tmin, t_closest, rec))
+                return false;
+            rec.object_ = nullptr;
+            return true;
+        });
+    case TypedPrimitive::other:
+        return intersect_each(range, t_closest, rec, [&](uint32_t i) { return others_[i]->intersect(r, tmin, t_closest, rec); });
+    }
+    return false;
+}
+
+bool TypedBVH::range_occluded(const TypedRange& range, const Ray& r, Real tmin, Real tmax) const
+{
+    switch (range.type_) {
+    case TypedPrimitive::sphere:
+        return occluded_any(range, [&](uint32_t i) { return spheres_[i].Sphere::occluded(r, tmin, tmax); });
+    case TypedPrimitive::moving_sphere:
+        return occluded_any(range, [&](uint32_t i) { return moving_spheres_[i].MovingSphere::occluded(r, tmin, tmax); });
+    case TypedPrimitive::xy_rect:
+        return occluded_any(range, [&](uint32_t i) { return xy_rects_[i].XYRect::occluded(r, tmin, tmax); });
+    case TypedPrimitive::xz_rect:
+        return occluded_any(range, [&](uint32_t i) { return xz_rects_[i].XZRect::occluded(r, tmin, tmax); });
+    case TypedPrimitive::yz_rect:
+        return occluded_any(range, [&](uint32_t i) { return yz_rects_[i].YZRect::occluded(r, tmin, tmax); });
+    case TypedPrimitive::box:
+        return occluded_any(range, [&](uint32_t i) { return boxes_[i].Box::occluded(r, tmin, tmax); });
+    case TypedPrimitive::mesh:
+        return occluded_any(range, [&](uint32_t i) { return meshes_[i]->TriangleMesh::occluded(r, tmin, tmax); });
+    case TypedPrimitive::medium:
+        return occluded_any(range, [&](uint32_t i) { return media_[i]->occluded(r, tmin, tmax); });
+    case TypedPrimitive::other:
+        return occluded_any(range, [&](uint32_t i) { return others_[i]->occluded(r, tmin, tmax); });
+    }
+    return false;
+}
+
+bool TypedBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool TypedBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    return linear_bvh_traverse(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = offset; i < offset + count; i++) {
+            if (range_intersect(ranges_[i], r, tmin, t_closest, rec))
+                hit_anything = true;
+        }
+        return hit_anything;
+    });
+}
+
+bool TypedBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, tmin, tmax, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = offset; i < offset + count; i++) {
+            if (range_occluded(ranges_[i], r, tmin, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool TypedBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
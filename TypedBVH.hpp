@@ -0,0 +1,85 @@
+#ifndef __TypedBVH_hpp__
+#define __TypedBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+#include "geometry/Sphere.hpp"
+#include "geometry/AARect.hpp"
+#include "geometry/Box.hpp"
+#include "geometry/TriangleMesh.hpp"
+#include "geometry/ConstantMedium.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/* The primitive types a TypedBVH stores in arrays of their own */
+enum class TypedPrimitive : uint8_t {
+    sphere,
+    moving_sphere,
+    xy_rect,
+    xz_rect,
+    yz_rect,
+    box,
+    mesh,
+    medium,
+    /* Any other Hittable, called through the vtable */
+    other,
+};
+
+/* Primitives [offset_, offset_ + count_) of the array of type_ */
+struct TypedRange {
+    uint32_t offset_;
+    uint16_t count_;
+    TypedPrimitive type_;
+};
+
+/*
+    A LinearBVH whose primitives are stored by type. The simple primitives are copied by value into an array
+    per type, meshes and media are referenced per type, and each leaf holds one range per type it contains.
+    A leaf tests a range in a loop over its type, where the intersection is a direct call that can be inlined,
+    instead of a virtual call per primitive through pointers spread over the heap
+*/
+class TypedBVH : public Hittable {
+public:
+    TypedBVH() {};
+
+    TypedBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    virtual bool has_random_hits() const override {
+        return random_hits_;
+    }
+
+private:
+    bool range_intersect(const TypedRange& range, const Ray& r, Real tmin, Real& t_closest, HitRecord& rec) const;
+    bool range_occluded(const TypedRange& range, const Ray& r, Real tmin, Real tmax) const;
+
+public:
+    /* Leaves reference ranges_ instead of primitives: primitives_offset_ is the first range, n_primitives_ the count */
+    std::vector<LinearBVHNode> nodes_;
+    std::vector<TypedRange> ranges_;
+
+    /* In leaf order, a primitive split by the builder is copied into every leaf that references it */
+    std::vector<Sphere> spheres_;
+    std::vector<MovingSphere> moving_spheres_;
+    std::vector<XYRect> xy_rects_;
+    std::vector<XZRect> xz_rects_;
+    std::vector<YZRect> yz_rects_;
+    std::vector<Box> boxes_;
+    std::vector<shared_ptr<TriangleMesh>> meshes_;
+    std::vector<shared_ptr<ConstantMedium>> media_;
+    std::vector<shared_ptr<Hittable>> others_;
+    bool random_hits_ = false;
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include "WideBVH.hpp"
+#include "BVHStats.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    The slab tests are done in double precision, like the rest of the renderer, so the float bounds are
+    widened on load. With AVX a group is 4 children, with SSE2 it's 2, otherwise children are tested one by one
+*/
+#if defined(__AVX__)
+static const int simd_lanes = 4;
+#elif defined(__SSE2__)
+static const int simd_lanes = 2;
+#else
+static const int simd_lanes = 1;
+#endif
+
+static_assert(BVH_WIDTH % simd_lanes == 0, "BVH_WIDTH should be a multiple of the SIMD width");
+
+/*
+    Test the ray against all the children of the node. Returns a mask with a bit set for every child hit,
+    and stores the entry distances in t_entry
+*/
+static inline unsigned node_hit(const WideBVHNode& node, const Ray& ray, Real tmin, Real tmax, Real t_entry[BVH_WIDTH])
+{
+    const float (*planes[2])[BVH_WIDTH] = { node.bounds_min_, node.bounds_max_ };
+    const float* near_planes[3];
+    const float* far_planes[3];
+    for (int a = 0; a < 3; a++) {
+        int neg = ray.dir_is_neg_[a];
+        near_planes[a] = planes[neg][a];
+        far_planes[a] = planes[1 - neg][a];
+    }
+
+    unsigned mask = 0;
+
+#if defined(__AVX__)
+    __m256d origin[3], inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+        origin[a] = _mm256_set1_pd(ray.origin_.e[a]);
+        inv_dir[a] = _mm256_set1_pd(ray.inv_direction_.e[a]);
+    }
+
+    for (int g = 0; g < BVH_WIDTH; g += simd_lanes) {
+        __m256d t_near = _mm256_set1_pd(tmin);
+        __m256d t_far = _mm256_set1_pd(tmax);
+        for (int a = 0; a < 3; a++) {
+            __m256d near_plane = _mm256_cvtps_pd(_mm_loadu_ps(near_planes[a] + g));
+            __m256d far_plane = _mm256_cvtps_pd(_mm_loadu_ps(far_planes[a] + g));
+            /* A NaN slab distance, when the origin lies on a plane parallel to the ray, leaves the interval as is */
+            t_near = _mm256_max_pd(_mm256_mul_pd(_mm256_sub_pd(near_plane, origin[a]), inv_dir[a]), t_near);
+            t_far = _mm256_min_pd(_mm256_mul_pd(_mm256_sub_pd(far_plane, origin[a]), inv_dir[a]), t_far);
+        }
+        _mm256_storeu_pd(t_entry + g, t_near);
+        mask |= static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(t_near, t_far, _CMP_LT_OQ))) << g;
+    }
+#elif defined(__SSE2__)
+    __m128d origin[3], inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+        origin[a] = _mm_set1_pd(ray.origin_.e[a]);
+        inv_dir[a] = _mm_set1_pd(ray.inv_direction_.e[a]);
+    }
+
+    for (int g = 0; g < BVH_WIDTH; g += simd_lanes) {
+        __m128d t_near = _mm_set1_pd(tmin);
+        __m128d t_far = _mm_set1_pd(tmax);
+        for (int a = 0; a < 3; a++) {
+            __m128d near_plane = _mm_set_pd(near_planes[a][g + 1], near_planes[a][g]);
+            __m128d far_plane = _mm_set_pd(far_planes[a][g + 1], far_planes[a][g]);
+            t_near = _mm_max_pd(_mm_mul_pd(_mm_sub_pd(near_plane, origin[a]), inv_dir[a]), t_near);
+            t_far = _mm_min_pd(_mm_mul_pd(_mm_sub_pd(far_plane, origin[a]), inv_dir[a]), t_far);
+        }
+        _mm_storeu_pd(t_entry + g, t_near);
+        mask |= static_cast<unsigned>(_mm_movemask_pd(_mm_cmplt_pd(t_near, t_far))) << g;
+    }
+#else
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        Real t_near = tmin;
+        Real t_far = tmax;
+        for (int a = 0; a < 3; a++) {
+            slab_clip(near_planes[a][c], far_planes[a][c], ray.origin_.e[a], ray.inv_direction_.e[a], t_near, t_far);
+        }
+        t_entry[c] = t_near;
+        if (t_near < t_far)
+            mask |= 1u << c;
+    }
+#endif
+
+    return mask;
+}
+
+WideBVH::WideBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options)
+{
+    if (list.objects_.empty())
+        return;
+
+    auto prims = bvh_primitive_info(list.objects_, 0, list.objects_.size(), time0, time1);
+
+    /* Leaf sizes have to fit in the node, and the depth in the traversal stack, like for the linear layout */
+    BVHBuildOptions build_options = LinearBVH::build_options(options);
+
+    auto root = bvh_build(prims, build_options);
+    bounds_ = root->bounds_;
+
+    nodes_.reserve(prims.size() / (BVH_WIDTH - 1) + 1);
+    primitives_.reserve(prims.size());
+    collapse(list.objects_, prims, *root);
+}
+
+uint32_t WideBVH::collapse(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node)
+{
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+
+    const BVHBuildNode* children[BVH_WIDTH];
+    int n_children = bvh_collapse_children(build_node, BVH_WIDTH, children);
+
+    for (int c = 0; c < BVH_WIDTH; c++) {
+        auto& node = nodes_[index];
+
+        if (c >= n_children) {
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min_[a][c] = std::numeric_limits<float>::infinity();
+                node.bounds_max_[a][c] = -std::numeric_limits<float>::infinity();
+            }
+            node.offset_[c] = 0;
+            node.n_primitives_[c] = 0;
+            continue;
+        }
+
+        const BVHBuildNode* child = children[c];
+        for (int a = 0; a < 3; a++) {
+            node.bounds_min_[a][c] = round_down_float(child->bounds_.min()[a]);
+            node.bounds_max_[a][c] = round_up_float(child->bounds_.max()[a]);
+        }
+
+        if (child->is_leaf()) {
+            node.offset_[c] = static_cast<uint32_t>(primitives_.size());
+            node.n_primitives_[c] = static_cast<uint16_t>(child->end_ - child->start_);
+            for (size_t i = child->start_; i < child->end_; i++)
+                primitives_.push_back(src_objects[prims[i].index_]);
+        } else {
+            node.n_primitives_[c] = 0;
+            /* nodes_ may grow while collapsing the child, so the node is looked up again after */
+            uint32_t child_index = collapse(src_objects, prims, *child);
+            nodes_[index].offset_[c] = child_index;
+        }
+    }
+
+    return index;
+}
+
+bool WideBVH::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool WideBVH::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
+    if (nodes_.empty())
+        return false;
+
+    /* Nodes that still have to be visited, with the distance the ray enters them */
+    struct StackEntry {
+        uint32_t node_;
+        Real t_entry_;
+    };
+    StackEntry stack[max_depth * BVH_WIDTH];
+    int stack_size = 0;
+    stack[stack_size++] = { 0, tmin };
+
+    bool hit_anything = false;
+    alignas(32) Real t_entry[BVH_WIDTH];
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        /* A closer hit was found after the node was pushed */
+        if (entry.t_entry_ >= tmax)
+            continue;
+
+        const WideBVHNode& node = nodes_[entry.node_];
+        BVH_STATS_ADD(nodes_visited_, 1);
+        unsigned mask = node_hit(node, r, tmin, tmax, t_entry);
+        if (!mask)
+            continue;
+
+        /* Order the children hit by entry distance */
+        int order[BVH_WIDTH];
+        int n_hit = 0;
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            if (!(mask & (1u << c)))
+                continue;
+            int i = n_hit++;
+            while (i > 0 && t_entry[order[i - 1]] > t_entry[c]) {
+                order[i] = order[i - 1];
+                i--;
+            }
+            order[i] = c;
+        }
+
+        /* Leaves are intersected right away, nearest first, so that tmax shrinks early */
+        for (int i = 0; i < n_hit; i++) {
+            int c = order[i];
+            if (node.n_primitives_[c] == 0 || t_entry[c] >= tmax)
+                continue;
+            BVH_STATS_ADD(primitives_tested_, node.n_primitives_[c]);
+            for (uint32_t p = 0; p < node.n_primitives_[c]; p++) {
+                if (primitives_[node.offset_[c] + p]->intersect(r, tmin, tmax, rec)) {
+                    hit_anything = true;
+                    tmax = rec.t_;
+                }
+            }
+        }
+
+        /* Interior children are pushed farthest first, so the nearest one is visited next */
+        for (int i = n_hit - 1; i >= 0; i--) {
+            int c = order[i];
+            if (node.n_primitives_[c] == 0 && t_entry[c] < tmax)
+                stack[stack_size++] = { node.offset_[c], t_entry[c] };
+        }
+    }
+
+    return hit_anything;
+}
+
+bool WideBVH::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    if (nodes_.empty())
+        return false;
+
+    /* Any hit ends the traversal, so children are visited in slot order */
+    uint32_t stack[max_depth * BVH_WIDTH];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    alignas(32) Real t_entry[BVH_WIDTH];
+
+    while (stack_size > 0) {
+        const WideBVHNode& node = nodes_[stack[--stack_size]];
+        BVH_STATS_ADD(nodes_visited_, 1);
+        unsigned mask = node_hit(node, r, tmin, tmax, t_entry);
+
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            if (!(mask & (1u << c)))
+                continue;
+            if (node.n_primitives_[c] == 0) {
+                stack[stack_size++] = node.offset_[c];
+                continue;
+            }
+            BVH_STATS_ADD(primitives_tested_, node.n_primitives_[c]);
+            for (uint32_t p = 0; p < node.n_primitives_[c]; p++) {
+                if (primitives_[node.offset_[c] + p]->occluded(r, tmin, tmax))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void WideBVH::refit(Real time0, Real time1)
+{
+    /* Child nodes are stored after their parent, so going backwards visits them first */
+    for (size_t i = nodes_.size(); i-- > 0;) {
+        WideBVHNode& node = nodes_[i];
+
+        for (int c = 0; c < BVH_WIDTH; c++) {
+            /* Only the root has index 0, so an interior slot never has a zero offset */
+            bool empty_slot = node.n_primitives_[c] == 0 && node.offset_[c] == 0;
+            if (empty_slot)
+                continue;
+
+            AABB box = AABB::empty();
+            if (node.n_primitives_[c] > 0) {
+                for (uint32_t p = 0; p < node.n_primitives_[c]; p++) {
+                    AABB primitive_box;
+                    if (primitives_[node.offset_[c] + p]->bounding_box(time0, time1, primitive_box))
+                        box.expand(primitive_box);
+                }
+            } else {
+                const WideBVHNode& child = nodes_[node.offset_[c]];
+                for (int k = 0; k < BVH_WIDTH; k++)
+                    for (int a = 0; a < 3; a++) {
+                        box.min_[a] = std::min<Real>(box.min_[a], child.bounds_min_[a][k]);
+                        box.max_[a] = std::max<Real>(box.max_[a], child.bounds_max_[a][k]);
+                    }
+            }
+
+            for (int a = 0; a < 3; a++) {
+                node.bounds_min_[a][c] = round_down_float(box.min()[a]);
+                node.bounds_max_[a][c] = round_up_float(box.max()[a]);
+            }
+        }
+    }
+
+    if (nodes_.empty())
+        return;
+
+    bounds_ = AABB::empty();
+    for (int c = 0; c < BVH_WIDTH; c++)
+        for (int a = 0; a < 3; a++) {
+            bounds_.min_[a] = std::min<Real>(bounds_.min_[a], nodes_[0].bounds_min_[a][c]);
+            bounds_.max_[a] = std::max<Real>(bounds_.max_[a], nodes_[0].bounds_max_[a][c]);
+        }
+}
+
+bool WideBVH::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = bounds_;
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef __WideBVH_hpp__
+#define __WideBVH_hpp__
+
+#include "Common.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include "geometry/Hittable.hpp"
+#include "geometry/HittableList.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/* Number of children per node, set from the build with -DBVH_WIDTH=4 or 8 */
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 4
+#endif
+
+static_assert(BVH_WIDTH == 4 || BVH_WIDTH == 8, "BVH_WIDTH should be 4 or 8");
+
+/*
+    A node with BVH_WIDTH children. Child bounds are stored per axis, so that the same plane of all the
+    children is a single vector load. Bounds are in single precision, rounded outwards. Empty child slots
+    have inverted bounds, so they are never hit
+*/
+struct alignas(64) WideBVHNode {
+    float bounds_min_[3][BVH_WIDTH];
+    float bounds_max_[3][BVH_WIDTH];
+    /* Interior child: index of its node. Leaf child: index of its first primitive */
+    uint32_t offset_[BVH_WIDTH];
+    /* Number of primitives of leaf children, 0 for interior children and empty slots */
+    uint16_t n_primitives_[BVH_WIDTH];
+};
+
+
+class WideBVH : public Hittable {
+public:
+    WideBVH() {};
+
+    WideBVH(const HittableList& list, Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    /* Recompute the node bounds bottom up, for primitives that moved. The tree structure is kept */
+    void refit(Real time0, Real time1);
+
+    /* Maximum depth of the binary tree the nodes are collapsed from */
+    static const int max_depth = LinearBVH::max_depth;
+
+public:
+    std::vector<WideBVHNode> nodes_;
+    /* Primitives ordered so that every leaf references a contiguous range */
+    std::vector<shared_ptr<Hittable>> primitives_;
+    AABB bounds_;
+
+private:
+    /* Collapse the binary subtree of build_node into wide nodes, returns the index of its root node */
+    uint32_t collapse(const std::vector<shared_ptr<Hittable>>& src_objects, const std::vector<BVHPrimitiveInfo>& prims, const BVHBuildNode& build_node);
+};
+
+#endif
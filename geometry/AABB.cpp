@@ -1,21 +1,6 @@
 #include "AABB.hpp"
 
 
-bool AABB::hit(const Ray& r, Real tmin, Real tmax) const {
-    for (int a = 0; a < 3; a++) {
-        auto invD = 1.0f / r.direction()[a];
-        auto t0 = (min()[a] - r.origin()[a]) * invD;
-        auto t1 = (max()[a] - r.origin()[a]) * invD;
-        if (invD < 0.0f)
-            std::swap(t0, t1);
-        tmin = t0 > tmin ? t0 : tmin;
-        tmax = t1 < tmax ? t1 : tmax;
-        if (tmax <= tmin)
-            return false;
-    }
-    return true;
-}
-
 AABB AABB::surrounding_box(AABB box0, AABB box1)
 {
     Point3 small(fmin(box0.min().x(), box1.min().x()),
@@ -28,3 +13,16 @@ AABB AABB::surrounding_box(AABB box0, AABB box1)
 
     return AABB(small, big);
 }
+
+AABB AABB::surrounding_box(AABB box, const Point3 & p)
+{
+    return AABB::surrounding_box(box, AABB(p, p));
+}
+
+int AABB::longest_axis() const
+{
+    auto d = max_ - min_;
+    if (d.x() > d.y() && d.x() > d.z())
+        return 0;
+    return (d.y() > d.z()) ? 1 : 2;
+}
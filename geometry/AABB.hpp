@@ -5,6 +5,20 @@
 #include "math/Vector3.hpp"
 #include "math/Ray.hpp"
 
+/*
+    Clip the ray interval [tmin, tmax] against the slab between the near and far plane of one axis, with the
+    planes already ordered by the sign of the direction. Compiles to a min and a max, without branches.
+    A zero direction component gives an infinite inv_dir, and NaN for a plane through the origin: the
+    comparisons keep the interval in that case, so such a ray is only culled by the other axes
+*/
+inline void slab_clip(Real near_plane, Real far_plane, Real origin, Real inv_dir, Real& tmin, Real& tmax)
+{
+    Real t0 = (near_plane - origin) * inv_dir;
+    Real t1 = (far_plane - origin) * inv_dir;
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+}
+
 class AABB {
 public:
     AABB() {}
@@ -21,9 +35,55 @@ public:
         return max_; 
     }
 
-    bool hit(const Ray& r, Real tmin, Real tmax) const;
+    /* Slab test with the cached inverse direction of r */
+    bool hit(const Ray& r, Real tmin, Real tmax) const {
+        const Point3* planes[2] = { &min_, &max_ };
+        for (int a = 0; a < 3; a++) {
+            int neg = r.dir_is_neg_[a];
+            slab_clip(planes[neg]->e[a], planes[1 - neg]->e[a], r.origin_.e[a], r.inv_direction_.e[a], tmin, tmax);
+        }
+        return tmin < tmax;
+    }
+
+    /* Center point of the box */
+    Point3 centroid() const {
+        return 0.5 * min_ + 0.5 * max_;
+    }
+
+    /* Total area of the six faces of the box */
+    Real surface_area() const {
+        auto d = max_ - min_;
+        if (d.x() < 0 || d.y() < 0 || d.z() < 0)
+            return 0;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    /* Index of the axis with the largest extent */
+    int longest_axis() const;
+
+    /* An inverted box, that becomes valid after the first union with another box or point */
+    static AABB empty() {
+        return AABB(Point3(infinity, infinity, infinity), Point3(-infinity, -infinity, -infinity));
+    }
 
     static AABB surrounding_box(AABB box0, AABB box1);
+    static AABB surrounding_box(AABB box, const Point3& p);
+
+    /* Grow the box in place to include b */
+    void expand(const AABB& b) {
+        for (int a = 0; a < 3; a++) {
+            min_.e[a] = b.min_.e[a] < min_.e[a] ? b.min_.e[a] : min_.e[a];
+            max_.e[a] = b.max_.e[a] > max_.e[a] ? b.max_.e[a] : max_.e[a];
+        }
+    }
+
+    /* Grow the box in place to include p */
+    void expand(const Point3& p) {
+        for (int a = 0; a < 3; a++) {
+            min_.e[a] = p.e[a] < min_.e[a] ? p.e[a] : min_.e[a];
+            max_.e[a] = p.e[a] > max_.e[a] ? p.e[a] : max_.e[a];
+        }
+    }
 
     Point3 min_;
     Point3 max_;
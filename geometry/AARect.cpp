@@ -2,29 +2,22 @@
 
 bool XYRect::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    auto t = (k_ - r.origin().z()) / r.direction().z();
-    /* Check if intersection happens within the time limit given */
-    if (t < t_min || t > t_max)
+    if (!XYRect::intersect(r, t_min, t_max, rec))
         return false;
 
-    auto x = r.origin().x() + t * r.direction().x();
-    auto y = r.origin().y() + t * r.direction().y();
-
-    /* Check if intersection point on z=k the plane is within the rectangle limits */
-    if (x < x0_ || x > x1_ || y < y0_ || y > y1_)
-        return false;
-
-    /* Set hit record */
-    rec.u_ = (x - x0_) / (x1_ - x0_);
-    rec.v_ = (y - y0_) / (y1_ - y0_);
-    rec.t_ = t;
-    auto outward_normal = Vector3(0, 0, 1);
-    rec.SetFaceNormal(r, outward_normal);
-    rec.mat_ = mat_;
-    rec.p_ = r.at(t);
+    finalize_hit(r, rec);
     return true;
 }
 
+void XYRect::finalize(const Ray & r, HitRecord & rec) const
+{
+    rec.u_ = (rec.u_ - x0_) / (x1_ - x0_);
+    rec.v_ = (rec.v_ - y0_) / (y1_ - y0_);
+    rec.SetFaceNormal(r, Vector3(0, 0, 1));
+    rec.mat_ = mat_.get();
+    rec.p_ = r.at(rec.t_);
+}
+
 bool XYRect::bounding_box(Real t0, Real t1, AABB & output_box) const
 {
     // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -36,25 +29,22 @@ bool XYRect::bounding_box(Real t0, Real t1, AABB & output_box) const
 
 bool XZRect::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    auto t = (k_ - r.origin().y()) / r.direction().y();
-    if (t < t_min || t > t_max)
-        return false;
-
-    auto x = r.origin().x() + t * r.direction().x();
-    auto z = r.origin().z() + t * r.direction().z();
-    if (x < x0_ || x > x1_ || z < z0_ || z > z1_)
+    if (!XZRect::intersect(r, t_min, t_max, rec))
         return false;
 
-    rec.u_ = (x - x0_) / (x1_ - x0_);
-    rec.v_ = (z - z0_) / (z1_ - z0_);
-    rec.t_ = t;
-    auto outward_normal = Vector3(0, 1, 0);
-    rec.SetFaceNormal(r, outward_normal);
-    rec.mat_ = mat_;
-    rec.p_ = r.at(t);
+    finalize_hit(r, rec);
     return true;
 }
 
+void XZRect::finalize(const Ray & r, HitRecord & rec) const
+{
+    rec.u_ = (rec.u_ - x0_) / (x1_ - x0_);
+    rec.v_ = (rec.v_ - z0_) / (z1_ - z0_);
+    rec.SetFaceNormal(r, Vector3(0, 1, 0));
+    rec.mat_ = mat_.get();
+    rec.p_ = r.at(rec.t_);
+}
+
 bool XZRect::bounding_box(Real t0, Real t1, AABB & output_box) const
 {
     // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -65,13 +55,14 @@ bool XZRect::bounding_box(Real t0, Real t1, AABB & output_box) const
 
 double XZRect::pdf_value(const Point3 & origin, const Vector3 & v) const
 {
-    HitRecord rec;
-    if (!this->hit(Ray(origin, v), 0.001, infinity, rec))
+    if (!XZRect::occluded(Ray(origin, v), 0.001, infinity))
         return 0;
 
+    /* The distance and the cosine only depend on the plane, so no hit record is needed */
+    auto t = (k_ - origin.y()) / v.y();
     auto area = (x1_ - x0_)*(z1_ - z0_);
-    auto distance_squared = rec.t_ * rec.t_ * v.length_squared();
-    auto cosine = fabs(dot(v, rec.normal_) / v.length());
+    auto distance_squared = t * t * v.length_squared();
+    auto cosine = fabs(v.y() / v.length());
 
     return distance_squared / (cosine * area);
 }
@@ -85,25 +76,22 @@ Vector3 XZRect::random(const Point3 & origin) const
 
 bool YZRect::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    auto t = (k_ - r.origin().x()) / r.direction().x();
-    if (t < t_min || t > t_max)
-        return false;
-
-    auto y = r.origin().y() + t * r.direction().y();
-    auto z = r.origin().z() + t * r.direction().z();
-    if (y < y0_ || y > y1_ || z < z0_ || z > z1_)
+    if (!YZRect::intersect(r, t_min, t_max, rec))
         return false;
 
-    rec.u_ = (y - y0_) / (y1_ - y0_);
-    rec.v_ = (z - z0_) / (z1_ - z0_);
-    rec.t_ = t;
-    auto outward_normal = Vector3(1, 0, 0);
-    rec.SetFaceNormal(r, outward_normal);
-    rec.mat_ = mat_;
-    rec.p_ = r.at(t);
+    finalize_hit(r, rec);
     return true;
 }
 
+void YZRect::finalize(const Ray & r, HitRecord & rec) const
+{
+    rec.u_ = (rec.u_ - y0_) / (y1_ - y0_);
+    rec.v_ = (rec.v_ - z0_) / (z1_ - z0_);
+    rec.SetFaceNormal(r, Vector3(1, 0, 0));
+    rec.mat_ = mat_.get();
+    rec.p_ = r.at(rec.t_);
+}
+
 bool YZRect::bounding_box(Real t0, Real t1, AABB & output_box) const
 {
     // The bounding box must have non-zero width in each dimension, so pad the X
@@ -11,7 +11,10 @@ public:
     XYRect(Real x0, Real x1, Real y0, Real y1, Real k, shared_ptr<Material> mat) : x0_(x0), x1_(x1), y0_(y0), y1_(y1), k_(k), mat_(mat) {};
 
     virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
 
 public:
     shared_ptr<Material> mat_;
@@ -25,7 +28,10 @@ public:
     XZRect(Real x0, Real x1, Real z0, Real z1, Real k, shared_ptr<Material> mat) : x0_(x0), x1_(x1), z0_(z0), z1_(z1), k_(k), mat_(mat) {};
 
     virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
 
     virtual Real pdf_value(const Point3& origin, const Vector3& v) const override;
     virtual Vector3 random(const Point3& origin) const override;
@@ -42,11 +48,107 @@ public:
     YZRect(Real y0, Real y1, Real z0, Real z1, Real k, shared_ptr<Material> mat) : y0_(y0), y1_(y1), z0_(z0), z1_(z1), k_(k), mat_(mat) {};
 
     virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
 
 public:
     shared_ptr<Material> mat_;
     Real y0_, y1_, z0_, z1_, k_;
 };
 
+
+/* Intersection tests are inline, so that typed BVH leaves can call them without a virtual call */
+
+inline bool XYRect::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    auto t = (k_ - r.origin().z()) / r.direction().z();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto y = r.origin().y() + t * r.direction().y();
+    if (x < x0_ || x > x1_ || y < y0_ || y > y1_)
+        return false;
+
+    /* The point in the plane, turned into uv coordinates in finalize */
+    rec.t_ = t;
+    rec.u_ = x;
+    rec.v_ = y;
+    rec.object_ = this;
+    return true;
+}
+
+inline bool XYRect::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    auto t = (k_ - r.origin().z()) / r.direction().z();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto y = r.origin().y() + t * r.direction().y();
+    return x >= x0_ && x <= x1_ && y >= y0_ && y <= y1_;
+}
+
+inline bool XZRect::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    auto t = (k_ - r.origin().y()) / r.direction().y();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto z = r.origin().z() + t * r.direction().z();
+    if (x < x0_ || x > x1_ || z < z0_ || z > z1_)
+        return false;
+
+    /* The point in the plane, turned into uv coordinates in finalize */
+    rec.t_ = t;
+    rec.u_ = x;
+    rec.v_ = z;
+    rec.object_ = this;
+    return true;
+}
+
+inline bool XZRect::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    auto t = (k_ - r.origin().y()) / r.direction().y();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto z = r.origin().z() + t * r.direction().z();
+    return x >= x0_ && x <= x1_ && z >= z0_ && z <= z1_;
+}
+
+inline bool YZRect::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    auto t = (k_ - r.origin().x()) / r.direction().x();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto y = r.origin().y() + t * r.direction().y();
+    auto z = r.origin().z() + t * r.direction().z();
+    if (y < y0_ || y > y1_ || z < z0_ || z > z1_)
+        return false;
+
+    /* The point in the plane, turned into uv coordinates in finalize */
+    rec.t_ = t;
+    rec.u_ = y;
+    rec.v_ = z;
+    rec.object_ = this;
+    return true;
+}
+
+inline bool YZRect::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    auto t = (k_ - r.origin().x()) / r.direction().x();
+    if (t < t_min || t > t_max)
+        return false;
+
+    auto y = r.origin().y() + t * r.direction().y();
+    auto z = r.origin().z() + t * r.direction().z();
+    return y >= y0_ && y <= y1_ && z >= z0_ && z <= z1_;
+}
+
 #endif
\ No newline at end of file
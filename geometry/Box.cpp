@@ -1,21 +1,31 @@
 #include "Box.hpp"
 
-Box::Box(const Point3 & p0, const Point3 & p1, shared_ptr<Material> mat)
+bool Box::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    box_min_ = p0;
-    box_max_ = p1;
-
-    sides_.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat));
-    sides_.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat));
+    if (!Box::intersect(r, t_min, t_max, rec))
+        return false;
 
-    sides_.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat));
-    sides_.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat));
-
-    sides_.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat));
-    sides_.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat));
+    finalize_hit(r, rec);
+    return true;
 }
 
-bool Box::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+void Box::finalize(const Ray & r, HitRecord & rec) const
 {
-    return sides_.hit(r, t_min, t_max, rec);
+    int axis = rec.primitive_ / 2;
+    bool max_face = rec.primitive_ % 2 == 1;
+
+    rec.p_ = r.at(rec.t_);
+    rec.p_.e[axis] = max_face ? box_max_.e[axis] : box_min_.e[axis];
+
+    Vector3 outward_normal(0, 0, 0);
+    outward_normal.e[axis] = max_face ? 1 : -1;
+    rec.SetFaceNormal(r, outward_normal);
+
+    /* Same layout as the rectangles: u along the lower of the other two axes, v along the higher */
+    int u_axis = axis == 0 ? 1 : 0;
+    int v_axis = axis == 2 ? 1 : 2;
+    rec.u_ = (rec.p_.e[u_axis] - box_min_.e[u_axis]) / (box_max_.e[u_axis] - box_min_.e[u_axis]);
+    rec.v_ = (rec.p_.e[v_axis] - box_min_.e[v_axis]) / (box_max_.e[v_axis] - box_min_.e[v_axis]);
+    rec.mat_ = mat_.get();
 }
+
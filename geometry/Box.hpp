@@ -3,24 +3,93 @@
 
 #include "Common.hpp"
 
-#include "AARect.hpp"
-#include "HittableList.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
 
+/*
+    An axis aligned box, intersected as a whole with a single slab test. The face that is hit gives the normal,
+    and the uv coordinates on the face, laid out like the rectangles of the same orientation
+*/
 class Box : public Hittable {
 public:
     Box() {};
-    Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat);
+    Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat) : box_min_(p0), box_max_(p1), mat_(mat) {};
 
     virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override {
         output_box = AABB(box_min_, box_max_);
         return true;
     }
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
 
 public:
     Point3 box_min_;
     Point3 box_max_;
-    HittableList sides_;
+    shared_ptr<Material> mat_;
 };
 
-#endif
\ No newline at end of file
+
+/* Intersection tests are inline, so that typed BVH leaves can call them without a virtual call */
+
+/*
+    Distances where the ray enters and exits the box, and the axes of the faces it crosses there. Distances
+    of planes the ray runs along come out as NaN, and are skipped by the comparisons
+*/
+inline void box_interval(const Point3& box_min, const Point3& box_max, const Ray& r, Real& t_enter, int& enter_axis, Real& t_exit, int& exit_axis)
+{
+    const Point3* planes[2] = { &box_min, &box_max };
+    t_enter = -infinity;
+    t_exit = infinity;
+    enter_axis = exit_axis = 0;
+
+    for (int a = 0; a < 3; a++) {
+        int neg = r.dir_is_neg_[a];
+        Real t0 = (planes[neg]->e[a] - r.origin_.e[a]) * r.inv_direction_.e[a];
+        Real t1 = (planes[1 - neg]->e[a] - r.origin_.e[a]) * r.inv_direction_.e[a];
+        enter_axis = t0 > t_enter ? a : enter_axis;
+        t_enter = t0 > t_enter ? t0 : t_enter;
+        exit_axis = t1 < t_exit ? a : exit_axis;
+        t_exit = t1 < t_exit ? t1 : t_exit;
+    }
+}
+
+inline bool Box::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    Real t_enter, t_exit;
+    int enter_axis, exit_axis;
+    box_interval(box_min_, box_max_, r, t_enter, enter_axis, t_exit, exit_axis);
+    if (t_enter > t_exit)
+        return false;
+
+    /* From inside, or when the entry is before t_min, the ray hits the face it exits through */
+    bool entering = t_enter >= t_min;
+    Real t = entering ? t_enter : t_exit;
+    if (t < t_min || t > t_max)
+        return false;
+
+    /* The entry face is the near plane of its axis, the exit face the far one */
+    int axis = entering ? enter_axis : exit_axis;
+    bool max_face = r.dir_is_neg_[axis] == entering;
+
+    /* The face, as 2 axis + max_face, is all finalize needs */
+    rec.t_ = t;
+    rec.primitive_ = 2 * axis + (max_face ? 1 : 0);
+    rec.object_ = this;
+    return true;
+}
+
+inline bool Box::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    Real t_enter, t_exit;
+    int enter_axis, exit_axis;
+    box_interval(box_min_, box_max_, r, t_enter, enter_axis, t_exit, exit_axis);
+    if (t_enter > t_exit)
+        return false;
+
+    Real t = t_enter >= t_min ? t_enter : t_exit;
+    return t >= t_min && t <= t_max;
+}
+
+#endif
@@ -0,0 +1,542 @@
+#include "ChunkedMesh.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <type_traits>
+
+static const char chunked_mesh_magic[8] = { 'R', 'T', 'C', 'M', 'E', 'S', 'H', '\0' };
+
+static_assert(std::is_trivially_copyable<Point3>::value, "Point3 is copied to and from the file as bytes");
+
+/* Size of the payload of a cluster, padded to a multiple of 8 */
+static uint64_t payload_size(uint64_t n_nodes, uint64_t n_vertices, uint64_t n_triangles, uint32_t flags)
+{
+    uint64_t size = n_nodes * sizeof(LinearBVHNode) + n_vertices * sizeof(Point3) + 3 * n_triangles * sizeof(uint32_t);
+    if (flags & ChunkedMesh::has_normals)
+        size += n_vertices * sizeof(Vector3);
+    if (flags & ChunkedMesh::has_uvs)
+        size += 2 * n_vertices * sizeof(Real);
+    return (size + 7) / 8 * 8;
+}
+
+/* Split triangles [begin, end) at the median centroid of their longest axis, until the ranges fit in a cluster */
+static void split_clusters(std::vector<uint32_t>& triangles, const std::vector<Point3>& centroids, size_t begin, size_t end,
+    size_t cluster_size, std::vector<std::pair<size_t, size_t>>& ranges)
+{
+    if (end - begin <= cluster_size) {
+        ranges.emplace_back(begin, end);
+        return;
+    }
+
+    AABB bounds = AABB::empty();
+    for (size_t i = begin; i < end; i++)
+        bounds.expand(centroids[triangles[i]]);
+    Vector3 extent = bounds.max() - bounds.min();
+    int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end, [&](uint32_t a, uint32_t b) {
+        return centroids[a][axis] < centroids[b][axis];
+    });
+
+    split_clusters(triangles, centroids, begin, mid, cluster_size, ranges);
+    split_clusters(triangles, centroids, mid, end, cluster_size, ranges);
+}
+
+template<typename T>
+static inline void write_values(std::ofstream& out, const std::vector<T>& values)
+{
+    out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+bool ChunkedMesh::write(const std::string& path, const std::vector<Point3>& positions, const std::vector<uint32_t>& indices,
+    const std::vector<Vector3>& normals, const std::vector<Real>& uvs, size_t cluster_size, const BVHBuildOptions& options)
+{
+    uint32_t flags = 0;
+    if (!normals.empty()) {
+        if (normals.size() == positions.size())
+            flags |= has_normals;
+        else
+            std::cerr << "ChunkedMesh: normal count doesn't match the vertex count, normals ignored.\n";
+    }
+    if (!uvs.empty()) {
+        if (uvs.size() == 2 * positions.size())
+            flags |= has_uvs;
+        else
+            std::cerr << "ChunkedMesh: uv count doesn't match the vertex count, uvs ignored.\n";
+    }
+
+    /* Triangles with out of range indices are dropped */
+    std::vector<uint32_t> triangles;
+    std::vector<Point3> centroids(indices.size() / 3);
+    triangles.reserve(indices.size() / 3);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        if (indices[i] >= positions.size() || indices[i + 1] >= positions.size() || indices[i + 2] >= positions.size()) {
+            std::cerr << "ChunkedMesh: vertex index out of range in triangle " << i / 3 << ".\n";
+            continue;
+        }
+        centroids[i / 3] = (positions[indices[i]] + positions[indices[i + 1]] + positions[indices[i + 2]]) / 3;
+        triangles.push_back(static_cast<uint32_t>(i / 3));
+    }
+
+    if (triangles.empty())
+        return false;
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    split_clusters(triangles, centroids, 0, triangles.size(), std::max<size_t>(cluster_size, 1), ranges);
+
+    /* Written to a temporary file first, like the BVH cache */
+    std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    ChunkedMeshHeader header = {};
+    std::memcpy(header.magic_, chunked_mesh_magic, sizeof(chunked_mesh_magic));
+    header.version_ = version;
+    header.node_size_ = sizeof(LinearBVHNode);
+    header.real_size_ = sizeof(Real);
+    header.flags_ = flags;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    /* The payloads, one cluster in memory at a time */
+    std::vector<ChunkedMeshCluster> clusters;
+    clusters.reserve(ranges.size());
+    std::vector<uint32_t> local_index(positions.size(), UINT32_MAX);
+    uint64_t offset = sizeof(header);
+    uint64_t n_triangles = 0;
+    const char padding[8] = {};
+
+    for (const auto& range : ranges) {
+        std::vector<uint32_t> local_vertices;
+        std::vector<uint32_t> local_indices;
+        local_indices.reserve(3 * (range.second - range.first));
+        for (size_t i = range.first; i < range.second; i++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * triangles[i] + k];
+                if (local_index[v] == UINT32_MAX) {
+                    local_index[v] = static_cast<uint32_t>(local_vertices.size());
+                    local_vertices.push_back(v);
+                }
+                local_indices.push_back(local_index[v]);
+            }
+        }
+
+        std::vector<Point3> local_positions;
+        std::vector<Vector3> local_normals;
+        std::vector<Real> local_uvs;
+        for (uint32_t v : local_vertices) {
+            local_positions.push_back(positions[v]);
+            if (flags & has_normals)
+                local_normals.push_back(normals[v]);
+            if (flags & has_uvs) {
+                local_uvs.push_back(uvs[2 * v]);
+                local_uvs.push_back(uvs[2 * v + 1]);
+            }
+            local_index[v] = UINT32_MAX;
+        }
+
+        /* The mesh builds the BVH of the cluster, and orders its triangles */
+        TriangleMesh mesh(std::move(local_positions), std::move(local_indices), nullptr, std::move(local_normals), std::move(local_uvs), options);
+
+        ChunkedMeshCluster cluster = {};
+        std::memcpy(cluster.bounds_min_, mesh.nodes_[0].bounds_min_, sizeof(cluster.bounds_min_));
+        std::memcpy(cluster.bounds_max_, mesh.nodes_[0].bounds_max_, sizeof(cluster.bounds_max_));
+        cluster.offset_ = offset;
+        cluster.n_nodes_ = static_cast<uint32_t>(mesh.nodes_.size());
+        cluster.n_vertices_ = static_cast<uint32_t>(mesh.positions_.size());
+        cluster.n_triangles_ = static_cast<uint32_t>(mesh.triangle_count());
+        cluster.first_triangle_ = static_cast<uint32_t>(n_triangles);
+        cluster.size_ = payload_size(cluster.n_nodes_, cluster.n_vertices_, cluster.n_triangles_, flags);
+
+        write_values(out, mesh.nodes_);
+        write_values(out, mesh.positions_);
+        write_values(out, mesh.normals_);
+        write_values(out, mesh.uvs_);
+        write_values(out, mesh.indices_);
+        /* Only the indices can end off a multiple of 8 */
+        out.write(padding, (8 - mesh.indices_.size() * sizeof(uint32_t) % 8) % 8);
+
+        offset += cluster.size_;
+        n_triangles += cluster.n_triangles_;
+        clusters.push_back(cluster);
+    }
+
+    /* The tree over the clusters */
+    std::vector<BVHPrimitiveInfo> prims(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const auto& cluster = clusters[c];
+        prims[c].index_ = c;
+        prims[c].bounds_ = AABB(Point3(cluster.bounds_min_[0], cluster.bounds_min_[1], cluster.bounds_min_[2]),
+            Point3(cluster.bounds_max_[0], cluster.bounds_max_[1], cluster.bounds_max_[2]));
+        prims[c].centroid_ = prims[c].bounds_.centroid();
+    }
+    std::vector<LinearBVHNode> nodes;
+    auto root = bvh_build(prims, LinearBVH::build_options(options));
+    linear_bvh_flatten(*root, nodes);
+
+    std::vector<uint32_t> references(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        references[i] = static_cast<uint32_t>(prims[i].index_);
+
+    header.index_offset_ = offset;
+    header.n_clusters_ = clusters.size();
+    header.n_nodes_ = nodes.size();
+    header.n_references_ = references.size();
+    header.n_triangles_ = n_triangles;
+    write_values(out, clusters);
+    write_values(out, nodes);
+    write_values(out, references);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    out.close();
+    if (!out) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+ChunkedMesh::ChunkedMesh(const std::string& path, shared_ptr<Material> mat, size_t memory_budget)
+    : mat_(mat), memory_budget_(memory_budget)
+{
+    if (!open(path)) {
+        std::cerr << "ChunkedMesh: could not open " << path << ".\n";
+        return;
+    }
+
+    slots_ = std::vector<ClusterSlot>(n_clusters_);
+    first_triangles_.reserve(n_clusters_);
+    for (size_t c = 0; c < n_clusters_; c++)
+        first_triangles_.push_back(clusters_[c].first_triangle_);
+}
+
+ChunkedMesh::~ChunkedMesh()
+{
+    for (auto& slot : slots_)
+        delete slot.mesh_.load(std::memory_order_relaxed);
+    for (const auto& retired : retired_)
+        delete retired.mesh_;
+}
+
+bool ChunkedMesh::open(const std::string& path)
+{
+    if (!file_.open(path))
+        return false;
+
+    ChunkedMeshHeader header;
+    bool valid = file_.size() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, file_.data(), sizeof(header));
+        uint64_t index_size = header.n_clusters_ * sizeof(ChunkedMeshCluster) + header.n_nodes_ * sizeof(LinearBVHNode)
+            + header.n_references_ * sizeof(uint32_t);
+        valid = std::memcmp(header.magic_, chunked_mesh_magic, sizeof(chunked_mesh_magic)) == 0 && header.version_ == version
+            && header.node_size_ == sizeof(LinearBVHNode) && header.real_size_ == sizeof(Real) && header.n_nodes_ > 0
+            && header.index_offset_ % 8 == 0 && header.index_offset_ + index_size == file_.size();
+    }
+    if (!valid) {
+        file_.close();
+        return false;
+    }
+
+    /* Everything is 8 byte aligned in the file, and mappings are page aligned, so the index is used in place */
+    flags_ = header.flags_;
+    clusters_ = reinterpret_cast<const ChunkedMeshCluster*>(file_.data() + header.index_offset_);
+    n_clusters_ = static_cast<size_t>(header.n_clusters_);
+    nodes_ = reinterpret_cast<const LinearBVHNode*>(clusters_ + n_clusters_);
+    n_nodes_ = static_cast<size_t>(header.n_nodes_);
+    references_ = reinterpret_cast<const uint32_t*>(nodes_ + n_nodes_);
+    n_triangles_ = static_cast<size_t>(header.n_triangles_);
+
+    for (size_t c = 0; c < n_clusters_ && valid; c++) {
+        const auto& cluster = clusters_[c];
+        valid = cluster.offset_ % 8 == 0 && cluster.offset_ + cluster.size_ <= header.index_offset_ && cluster.n_nodes_ > 0
+            && cluster.size_ == payload_size(cluster.n_nodes_, cluster.n_vertices_, cluster.n_triangles_, flags_);
+    }
+    for (size_t i = 0; i < header.n_references_ && valid; i++)
+        valid = references_[i] < n_clusters_;
+
+    if (!valid) {
+        clusters_ = nullptr;
+        nodes_ = nullptr;
+        references_ = nullptr;
+        n_clusters_ = n_nodes_ = n_triangles_ = 0;
+        file_.close();
+    }
+    return valid;
+}
+
+template<typename T>
+static inline const unsigned char* read_values(const unsigned char* data, std::vector<T>& values, size_t count)
+{
+    values.resize(count);
+    std::memcpy(values.data(), data, count * sizeof(T));
+    return data + count * sizeof(T);
+}
+
+const TriangleMesh* ChunkedMesh::load(uint32_t c, size_t& bytes) const
+{
+    const auto& cluster = clusters_[c];
+    std::vector<LinearBVHNode> nodes;
+    std::vector<Point3> positions;
+    std::vector<Vector3> normals;
+    std::vector<Real> uvs;
+    std::vector<uint32_t> indices;
+
+    const unsigned char* data = file_.data() + cluster.offset_;
+    data = read_values(data, nodes, cluster.n_nodes_);
+    data = read_values(data, positions, cluster.n_vertices_);
+    if (flags_ & has_normals)
+        data = read_values(data, normals, cluster.n_vertices_);
+    if (flags_ & has_uvs)
+        data = read_values(data, uvs, 2 * static_cast<size_t>(cluster.n_vertices_));
+    read_values(data, indices, 3 * static_cast<size_t>(cluster.n_triangles_));
+
+    /* The copy is the only one counted against the budget, the mapped pages are given back */
+    file_.release(static_cast<size_t>(cluster.offset_), static_cast<size_t>(cluster.size_));
+
+    bytes = sizeof(TriangleMesh) + nodes.size() * sizeof(LinearBVHNode) + positions.size() * sizeof(Point3)
+        + normals.size() * sizeof(Vector3) + uvs.size() * sizeof(Real) + indices.size() * sizeof(uint32_t);
+    return new TriangleMesh(std::move(positions), std::move(indices), std::move(nodes), mat_, std::move(normals), std::move(uvs));
+}
+
+/*
+    Epoch based reclamation of the dropped clusters. Every thread that queries a chunked mesh publishes the
+    value of reclaim_epoch when its query starts, in a record of its own, and clears it when the query ends.
+    A dropped cluster is tagged with the epoch after its slot is cleared, a query that started later can't
+    find it anymore. It is freed once no record holds an epoch up to its tag
+*/
+struct ReaderRecord {
+    std::atomic<uint64_t> pinned_{ std::numeric_limits<uint64_t>::max() };
+    /* Owned by a thread, records of threads that exited are reused */
+    std::atomic<bool> claimed_{ true };
+    ReaderRecord* next_ = nullptr;
+};
+
+static std::atomic<ReaderRecord*> reader_records{ nullptr };
+static std::atomic<uint64_t> reclaim_epoch{ 0 };
+
+static ReaderRecord* claim_reader_record()
+{
+    for (ReaderRecord* record = reader_records.load(std::memory_order_acquire); record; record = record->next_) {
+        bool expected = false;
+        if (record->claimed_.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return record;
+    }
+
+    /* Records are never freed, there are at most as many as threads that ran queries at the same time */
+    ReaderRecord* record = new ReaderRecord();
+    record->next_ = reader_records.load(std::memory_order_relaxed);
+    while (!reader_records.compare_exchange_weak(record->next_, record, std::memory_order_release, std::memory_order_relaxed))
+        ;
+    return record;
+}
+
+struct ThreadReader {
+    ReaderRecord* record_ = claim_reader_record();
+    /* Queries nested in another one keep its epoch */
+    int depth_ = 0;
+
+    ~ThreadReader() {
+        record_->claimed_.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadReader thread_reader;
+
+/* Pins the current epoch for the duration of a query */
+class ReaderPin {
+public:
+    ReaderPin() : reader_(thread_reader) {
+        if (reader_.depth_++ == 0)
+            reader_.record_->pinned_.store(reclaim_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+    }
+
+    ~ReaderPin() {
+        if (--reader_.depth_ == 0)
+            reader_.record_->pinned_.store(std::numeric_limits<uint64_t>::max(), std::memory_order_release);
+    }
+
+private:
+    ThreadReader& reader_;
+};
+
+const TriangleMesh* ChunkedMesh::acquire(uint32_t c) const
+{
+    ClusterSlot& slot = slots_[c];
+
+    /* Only written when it changes, so that the threads don't keep writing to the same slots */
+    uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+    if (slot.last_use_.load(std::memory_order_relaxed) != epoch)
+        slot.last_use_.store(epoch, std::memory_order_relaxed);
+
+    /* Wait for the thread reading the cluster, if there is one, instead of reading it again */
+    while (true) {
+        const TriangleMesh* mesh = slot.mesh_.load(std::memory_order_seq_cst);
+        if (mesh)
+            return mesh;
+        bool expected = false;
+        if (slot.loading_.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            break;
+        std::this_thread::yield();
+    }
+
+    /* Loaded by another thread between the two tests */
+    const TriangleMesh* mesh = slot.mesh_.load(std::memory_order_seq_cst);
+    if (mesh) {
+        slot.loading_.store(false, std::memory_order_release);
+        return mesh;
+    }
+
+    size_t bytes = 0;
+    mesh = load(c, bytes);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slot.bytes_ = bytes;
+        slot.last_use_.store(epoch_.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot.mesh_.store(mesh, std::memory_order_seq_cst);
+        resident_.push_back(c);
+        resident_bytes_ += bytes;
+        loads_.fetch_add(1, std::memory_order_relaxed);
+
+        evict(c);
+        reclaim();
+    }
+    slot.loading_.store(false, std::memory_order_release);
+    return mesh;
+}
+
+void ChunkedMesh::evict(uint32_t keep) const
+{
+    while (resident_bytes_ > memory_budget_) {
+        size_t oldest = resident_.size();
+        for (size_t i = 0; i < resident_.size(); i++) {
+            if (resident_[i] == keep)
+                continue;
+            if (oldest == resident_.size()
+                || slots_[resident_[i]].last_use_.load(std::memory_order_relaxed) < slots_[resident_[oldest]].last_use_.load(std::memory_order_relaxed))
+                oldest = i;
+        }
+        if (oldest == resident_.size())
+            return;
+
+        /* Queries still traversing the cluster found it before the slot was cleared, they have an older epoch */
+        ClusterSlot& slot = slots_[resident_[oldest]];
+        const TriangleMesh* mesh = slot.mesh_.exchange(nullptr, std::memory_order_seq_cst);
+        retired_.push_back({ mesh, reclaim_epoch.fetch_add(1, std::memory_order_seq_cst) });
+        resident_bytes_ -= slot.bytes_;
+        slot.bytes_ = 0;
+        resident_[oldest] = resident_.back();
+        resident_.pop_back();
+    }
+}
+
+void ChunkedMesh::reclaim() const
+{
+    if (retired_.empty())
+        return;
+
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (ReaderRecord* record = reader_records.load(std::memory_order_acquire); record; record = record->next_)
+        oldest = std::min(oldest, record->pinned_.load(std::memory_order_seq_cst));
+
+    size_t kept = 0;
+    for (const auto& retired : retired_) {
+        if (retired.epoch_ < oldest)
+            delete retired.mesh_;
+        else
+            retired_[kept++] = retired;
+    }
+    retired_.resize(kept);
+}
+
+size_t ChunkedMesh::resident_bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resident_bytes_;
+}
+
+/* Test the bounds of a cluster before it is loaded, a leaf of the tree over the clusters can hold several */
+static inline bool cluster_overlaps(const ChunkedMeshCluster& cluster, const Ray& r, Real t_min, Real t_max)
+{
+    for (int a = 0; a < 3; a++) {
+        int neg = r.dir_is_neg_[a];
+        Real near = neg ? cluster.bounds_max_[a] : cluster.bounds_min_[a];
+        Real far = neg ? cluster.bounds_min_[a] : cluster.bounds_max_[a];
+        slab_clip(near, far, r.origin_.e[a], r.inv_direction_.e[a], t_min, t_max);
+    }
+    return t_min <= t_max;
+}
+
+bool ChunkedMesh::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    if (!ChunkedMesh::intersect(r, t_min, t_max, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool ChunkedMesh::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    ReaderPin pin;
+    /* The hit keeps the triangle index in the whole mesh, the cluster could be evicted before finalize */
+    bool found = linear_bvh_traverse(nodes_, n_nodes_, r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t i = offset; i < offset + count; i++) {
+            uint32_t c = references_[i];
+            if (!cluster_overlaps(clusters_[c], r, t_min, t_closest))
+                continue;
+            if (acquire(c)->TriangleMesh::intersect(r, t_min, t_closest, rec)) {
+                hit_anything = true;
+                t_closest = rec.t_;
+                rec.primitive_ += clusters_[c].first_triangle_;
+            }
+        }
+        return hit_anything;
+    });
+
+    if (!found)
+        return false;
+
+    rec.object_ = this;
+    return true;
+}
+
+void ChunkedMesh::finalize(const Ray & r, HitRecord & rec) const
+{
+    ReaderPin pin;
+    uint32_t c = static_cast<uint32_t>(std::upper_bound(first_triangles_.begin(), first_triangles_.end(), rec.primitive_) - first_triangles_.begin() - 1);
+    rec.primitive_ -= first_triangles_[c];
+    acquire(c)->TriangleMesh::finalize(r, rec);
+}
+
+bool ChunkedMesh::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    ReaderPin pin;
+    return linear_bvh_traverse<true>(nodes_, n_nodes_, r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        for (uint32_t i = offset; i < offset + count; i++) {
+            uint32_t c = references_[i];
+            if (cluster_overlaps(clusters_[c], r, t_min, t_closest) && acquire(c)->TriangleMesh::occluded(r, t_min, t_closest))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool ChunkedMesh::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (n_nodes_ == 0)
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
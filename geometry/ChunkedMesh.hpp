@@ -0,0 +1,166 @@
+#ifndef __ChunkedMesh_hpp__
+#define __ChunkedMesh_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "TriangleMesh.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "MappedFile.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+    Header of a chunked mesh file. It is followed by the cluster payloads, each at an offset multiple of 8: the
+    LinearBVHNode array of the cluster, its Point3 positions, its Vector3 normals and its two Real uvs per vertex
+    if the mesh has them, and its three uint32_t vertex indices per triangle, in the leaf order of its nodes.
+    The index starts at index_offset_ and ends the file: the ChunkedMeshCluster table, the LinearBVHNode array
+    of the tree over the clusters, and the uint32_t cluster index of every leaf reference, in leaf order
+*/
+struct ChunkedMeshHeader {
+    char magic_[8];
+    uint32_t version_;
+    /* sizeof(LinearBVHNode) and sizeof(Real) of the writer */
+    uint32_t node_size_;
+    uint32_t real_size_;
+    /* ChunkedMesh::has_normals and ChunkedMesh::has_uvs */
+    uint32_t flags_;
+    uint64_t index_offset_;
+    uint64_t n_clusters_;
+    uint64_t n_nodes_;
+    uint64_t n_references_;
+    uint64_t n_triangles_;
+};
+
+static_assert(sizeof(ChunkedMeshHeader) == 64, "ChunkedMeshHeader should be 64 bytes");
+
+/* A spatially coherent part of the mesh, with vertices and a BVH of its own */
+struct ChunkedMeshCluster {
+    float bounds_min_[3];
+    float bounds_max_[3];
+    /* Offset of the payload from the start of the file, and its size in bytes */
+    uint64_t offset_;
+    uint64_t size_;
+    uint32_t n_nodes_;
+    uint32_t n_vertices_;
+    uint32_t n_triangles_;
+    /* Index of the first triangle of the cluster in the whole mesh */
+    uint32_t first_triangle_;
+};
+
+static_assert(sizeof(ChunkedMeshCluster) == 56, "ChunkedMeshCluster should be 56 bytes");
+
+/*
+    A triangle mesh stored out of core. The file is memory mapped, and only the cluster table and the tree over
+    the clusters stay in memory. A cluster is read into a TriangleMesh the first time a ray reaches its leaf,
+    and the least recently used clusters are dropped when the loaded ones take more than the memory budget.
+    Rays find the loaded clusters without locking. A dropped cluster is only freed once every thread that
+    could still be traversing it is done with its query, so the budget can be exceeded by those clusters
+*/
+class ChunkedMesh : public Hittable {
+public:
+    ChunkedMesh(const std::string& path, shared_ptr<Material> mat, size_t memory_budget);
+    ~ChunkedMesh();
+
+    ChunkedMesh(const ChunkedMesh&) = delete;
+    ChunkedMesh& operator=(const ChunkedMesh&) = delete;
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
+    size_t cluster_count() const {
+        return n_clusters_;
+    }
+
+    size_t triangle_count() const {
+        return n_triangles_;
+    }
+
+    /* Bytes taken by the loaded clusters */
+    size_t resident_bytes() const;
+
+    /* Number of times a cluster was read from the file */
+    size_t cluster_loads() const {
+        return loads_.load(std::memory_order_relaxed);
+    }
+
+    /*
+        Split the triangles into clusters of at most cluster_size triangles, by median splits of their
+        centroids, and write them to path. The arguments are the ones of the TriangleMesh constructor,
+        options are used for the BVH of every cluster and for the tree over them. Returns false on failure
+    */
+    static bool write(const std::string& path, const std::vector<Point3>& positions, const std::vector<uint32_t>& indices,
+        const std::vector<Vector3>& normals = {}, const std::vector<Real>& uvs = {}, size_t cluster_size = 4096,
+        const BVHBuildOptions& options = BVHBuildOptions());
+
+    static const uint32_t version = 1;
+    static const uint32_t has_normals = 1;
+    static const uint32_t has_uvs = 2;
+
+private:
+    struct ClusterSlot {
+        /* Null while the cluster isn't loaded */
+        std::atomic<const TriangleMesh*> mesh_{ nullptr };
+        /* Set by the thread reading the cluster, the others wait for it instead of reading it too */
+        std::atomic<bool> loading_{ false };
+        size_t bytes_ = 0;
+        /* Value of epoch_ when the cluster was last used */
+        std::atomic<uint64_t> last_use_{ 0 };
+    };
+
+    /* A dropped cluster, and the reclamation epoch it was dropped at */
+    struct RetiredCluster {
+        const TriangleMesh* mesh_;
+        uint64_t epoch_;
+    };
+
+    /* Map path and check its layout, returns false otherwise */
+    bool open(const std::string& path);
+
+    /* The mesh of cluster c, read from the file if it isn't loaded. Valid until the query pinning it ends */
+    const TriangleMesh* acquire(uint32_t c) const;
+
+    /* Read cluster c from the mapping into a new mesh, and drop its pages */
+    const TriangleMesh* load(uint32_t c, size_t& bytes) const;
+
+    /* Drop the least recently used clusters other than keep until the budget is met. Called with mutex_ held */
+    void evict(uint32_t keep) const;
+
+    /* Free the dropped clusters no query can still be using. Called with mutex_ held */
+    void reclaim() const;
+
+    MappedFile file_;
+    shared_ptr<Material> mat_;
+    uint32_t flags_ = 0;
+    const ChunkedMeshCluster* clusters_ = nullptr;
+    size_t n_clusters_ = 0;
+    const LinearBVHNode* nodes_ = nullptr;
+    size_t n_nodes_ = 0;
+    const uint32_t* references_ = nullptr;
+    size_t n_triangles_ = 0;
+    /* first_triangle_ of every cluster, to find the cluster of a hit */
+    std::vector<uint32_t> first_triangles_;
+
+    size_t memory_budget_;
+    mutable std::vector<ClusterSlot> slots_;
+    /* The loaded clusters, in no order */
+    mutable std::vector<uint32_t> resident_;
+    /* The dropped clusters that are not freed yet */
+    mutable std::vector<RetiredCluster> retired_;
+    /* Serializes the updates of resident_ and retired_, the reads from the file are done outside of it */
+    mutable std::mutex mutex_;
+    mutable size_t resident_bytes_ = 0;
+    /* Advanced by every load, the clusters used since the last load share the same recency */
+    mutable std::atomic<uint64_t> epoch_{ 0 };
+    mutable std::atomic<size_t> loads_{ 0 };
+};
+
+#endif
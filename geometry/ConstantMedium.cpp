@@ -8,12 +8,12 @@ bool ConstantMedium::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec)
 
     HitRecord rec1, rec2;
 
-    /* Hold in rec1, the point of entry in the volume */
-    if (!boundary_->hit(r, -infinity, infinity, rec1))
+    /* Hold in rec1, the point of entry in the volume. Only the distances are needed, the records are not finalized */
+    if (!boundary_->intersect(r, -infinity, infinity, rec1))
         return false;
 
     /* Hold in rec2, the point of exit in the volume */
-    if (!boundary_->hit(r, rec1.t_ + 0.0001, infinity, rec2))
+    if (!boundary_->intersect(r, rec1.t_ + 0.0001, infinity, rec2))
         return false;
 
     if (debugging) std::cerr << "\nt0=" << rec1.t_ << ", t1=" << rec2.t_ << '\n';
@@ -48,7 +48,7 @@ bool ConstantMedium::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec)
 
     rec.normal_ = Vector3(1, 0, 0);  // arbitrary
     rec.front_face_ = true;     // also arbitrary
-    rec.mat_ = phase_function_;
+    rec.mat_ = phase_function_.get();
 
     return true;
 }
@@ -18,6 +18,11 @@ public:
         return boundary_->bounding_box(t0, t1, output_box);
     }
 
+    /* The scattering distance is sampled on every hit */
+    virtual bool has_random_hits() const override {
+        return true;
+    }
+
 public:
     shared_ptr<Hittable> boundary_;
     shared_ptr<Material> phase_function_;
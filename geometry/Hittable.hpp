@@ -6,15 +6,18 @@
 #include "math/Vector3.hpp"
 #include "geometry/AABB.hpp"
 
+#include <cstdint>
+
 class Material;
+class Hittable;
 
 struct HitRecord {
     /* Intersection point */
     Point3 p_;
     /* Normal on intersection */
     Vector3 normal_;
-    /* Material of intersection point */
-    shared_ptr<Material> mat_;
+    /* Material of intersection point, owned by the object that was hit */
+    const Material* mat_ = nullptr;
     /* Value of t in the ray parametric representation */
     Real t_;
     /* u coordinate of intersection point (texturing) */
@@ -23,6 +26,13 @@ struct HitRecord {
     Real v_;
     /* Is a front face or a back face? */
     bool front_face_;
+    /*
+        Set by Hittable::intersect to the object that completes the record in finalize, with the index of
+        the primitive within it. Until then u_ and v_ hold whatever local coordinates that object needs.
+        Null once the record is complete
+    */
+    const Hittable* object_ = nullptr;
+    uint32_t primitive_;
 
     inline void SetFaceNormal(const Ray& r, const Vector3& outward_normal) {
         front_face_ = dot(r.direction(), outward_normal) < 0;
@@ -33,12 +43,47 @@ struct HitRecord {
 
 class Hittable {
 public:
+    virtual ~Hittable() = default;
+
     /* Caclulate the intersection with object, within the given time margin, store the result to rec */
     virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const = 0;
 
+    /*
+        Like hit, but only finds the intersection: t_ and what finalize needs to fill in the rest of the
+        record. Traversals call this on every candidate, and finalize the closest one, so the normal, uv
+        coordinates and material are computed once per ray. rec is left as it was on a miss. Objects that do
+        not split the two return a complete record
+    */
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const {
+        if (!hit(r, t_min, t_max, rec))
+            return false;
+        rec.object_ = nullptr;
+        return true;
+    }
+
+    /* Complete a record of this object found by intersect, with the same ray */
+    virtual void finalize(const Ray&, HitRecord&) const {}
+
     /* Return the bounding box of the object, within the given time margin */
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const = 0;
+
+    /*
+        Check if the ray hits the object within [t_min, t_max]. Returns at the first hit found, and does not
+        compute a hit record. Used for visibility tests, where the closest hit is not needed
+    */
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const {
+        HitRecord rec;
+        return hit(r, t_min, t_max, rec);
+    }
     
+    /*
+        True if hit draws random numbers, like participating media do. Such objects must be tested at most
+        once per ray, so a BVH never references them from more than one leaf
+    */
+    virtual bool has_random_hits() const {
+        return false;
+    }
+
     /* Caclulate the probability the a ray starting from o towards v, hits the object */
     virtual double pdf_value(const Point3& o, const Vector3& v) const {
         return 0.0;
@@ -51,33 +96,15 @@ public:
 };
 
 
-class Translate : public Hittable {
-public:
-    Translate(shared_ptr<Hittable> p, const Vector3& displacement): ptr_(p), offset_(displacement) {}
-
-    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
-    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
-
-public:
-    shared_ptr<Hittable> ptr_;
-    Vector3 offset_;
-};
-
-
-class RotateY : public Hittable {
-public:
-    RotateY(shared_ptr<Hittable> p, const Real angle);
-
-    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
-    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
-
-public:
-    shared_ptr<Hittable> ptr_;
-    double sin_theta_;
-    double cos_theta_;
-    bool hasbox_;
-    AABB bbox_;
-};
+/* Complete the record of the closest hit found by intersect, if it is not already */
+inline void finalize_hit(const Ray& r, HitRecord& rec)
+{
+    if (!rec.object_)
+        return;
+    const Hittable* object = rec.object_;
+    rec.object_ = nullptr;
+    object->finalize(r, rec);
+}
 
 
 class FlipFace : public Hittable {
@@ -98,6 +125,14 @@ public:
         return ptr_->bounding_box(t0, t1, output_box);
     }
 
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override {
+        return ptr_->occluded(r, t_min, t_max);
+    }
+
+    virtual bool has_random_hits() const override {
+        return ptr_->has_random_hits();
+    }
+
 public:
     shared_ptr<Hittable> ptr_;
 };
@@ -2,21 +2,49 @@
 
 bool HittableList::hit(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
 {
-    HitRecord temp_rec;
+    if (!intersect(r, tmin, tmax, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool HittableList::intersect(const Ray & r, Real tmin, Real tmax, HitRecord & rec) const
+{
     bool hit_anything = false;
     auto closest_so_far = tmax;
 
+    /* A miss leaves rec as it was, so the closest hit stays in it without copies */
     for (const auto& object : objects_) {
-        if (object->hit(r, tmin, closest_so_far, temp_rec)) {
+        if (object->intersect(r, tmin, closest_so_far, rec)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t_;
-            rec = temp_rec;
+            closest_so_far = rec.t_;
         }
     }
 
     return hit_anything;
 }
 
+bool HittableList::occluded(const Ray & r, Real tmin, Real tmax) const
+{
+    for (const auto& object : objects_) {
+        if (object->occluded(r, tmin, tmax))
+            return true;
+    }
+
+    return false;
+}
+
+bool HittableList::has_random_hits() const
+{
+    for (const auto& object : objects_) {
+        if (object->has_random_hits())
+            return true;
+    }
+
+    return false;
+}
+
 bool HittableList::bounding_box(double t0, double t1, AABB & output_box) const
 {
     if (objects_.empty()) return false;
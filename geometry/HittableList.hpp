@@ -25,9 +25,14 @@ public:
     }
 
     virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
 
     virtual bool bounding_box(double t0, double t1, AABB& output_box) const override;
 
+    virtual bool occluded(const Ray& r, Real tmin, Real tmax) const override;
+
+    virtual bool has_random_hits() const override;
+
     virtual double pdf_value(const Point3& o, const Vector3& v) const override;
 
     virtual Vector3 random(const Vector3& o) const override;
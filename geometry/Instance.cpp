@@ -0,0 +1,58 @@
+#include "Instance.hpp"
+
+Instance::Instance(shared_ptr<Hittable> object, const Transform & transform) : object_(object), transform_(transform)
+{
+    /* The object was already collapsed on its own construction, so one level is enough */
+    if (auto inner = std::dynamic_pointer_cast<Instance>(object_)) {
+        object_ = inner->object_;
+        transform_ = transform * inner->transform_;
+    }
+
+    AABB box = AABB::empty();
+    has_box_ = object_->bounding_box(0, 1, box);
+
+    /* Bounds of the eight transformed corners of the object bounds */
+    bbox_ = AABB::empty();
+    if (!has_box_)
+        return;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                Point3 corner(
+                    i ? box.max().x() : box.min().x(),
+                    j ? box.max().y() : box.min().y(),
+                    k ? box.max().z() : box.min().z());
+                bbox_.expand(transform_.point(corner));
+            }
+        }
+    }
+}
+
+bool Instance::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    /* The direction is not normalized, so t is the same in both spaces */
+    Ray object_r(transform_.inverse_point(r.origin()), transform_.inverse_vector(r.direction()), r.Time());
+    if (!object_->hit(object_r, t_min, t_max, rec))
+        return false;
+
+    /*
+        The stored normal already faces against the ray, and the inverse transpose keeps the sign of
+        its dot product with the direction, so the face side stays the same
+    */
+    rec.p_ = transform_.point(rec.p_);
+    rec.normal_ = unit_vector(transform_.normal(rec.normal_));
+
+    return true;
+}
+
+bool Instance::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    Ray object_r(transform_.inverse_point(r.origin()), transform_.inverse_vector(r.direction()), r.Time());
+    return object_->occluded(object_r, t_min, t_max);
+}
+
+bool Instance::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    output_box = bbox_;
+    return has_box_;
+}
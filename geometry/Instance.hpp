@@ -0,0 +1,47 @@
+#ifndef __Instance_hpp__
+#define __Instance_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "math/Transform.hpp"
+
+/*
+    A placement of a shared object in the scene. The object is usually a bottom level BVH, that many
+    instances reference without copying it. An instance of an instance collapses into a single one, with
+    the two transforms combined, so a ray is transformed once however deep the nesting
+*/
+class Instance : public Hittable {
+public:
+    Instance(shared_ptr<Hittable> object, const Transform& transform);
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+    virtual bool has_random_hits() const override {
+        return object_->has_random_hits();
+    }
+
+public:
+    shared_ptr<Hittable> object_;
+    /* From object space to world space */
+    Transform transform_;
+    /* World space bounds, computed once. Empty if the object has none */
+    AABB bbox_;
+    bool has_box_ = false;
+};
+
+
+/* Instances with a single translation or rotation, for scenes written as chains of them */
+class Translate : public Instance {
+public:
+    Translate(shared_ptr<Hittable> p, const Vector3& displacement) : Instance(p, Transform::translate(displacement)) {}
+};
+
+
+class RotateY : public Instance {
+public:
+    /* Rotation around the Y axis, in degrees */
+    RotateY(shared_ptr<Hittable> p, const Real angle) : Instance(p, Transform::rotate_y(angle)) {}
+};
+
+#endif
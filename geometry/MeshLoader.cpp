@@ -0,0 +1,464 @@
+#include "MeshLoader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+/* The attribute indices of an OBJ face vertex, -1 when not given */
+struct ObjVertexKey {
+    int position_, uv_, normal_;
+
+    bool operator==(const ObjVertexKey& other) const {
+        return position_ == other.position_ && uv_ == other.uv_ && normal_ == other.normal_;
+    }
+};
+
+struct ObjVertexKeyHash {
+    size_t operator()(const ObjVertexKey& key) const {
+        return static_cast<size_t>(key.position_) * 73856093u ^ static_cast<size_t>(key.uv_) * 19349663u ^ static_cast<size_t>(key.normal_) * 83492791u;
+    }
+};
+
+static const char* skip_spaces(const char* s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    return s;
+}
+
+/* Parse up to n numbers from s into values, returns how many were read */
+static int parse_reals(const char* s, Real* values, int n)
+{
+    int count = 0;
+    while (count < n) {
+        char* end;
+        double value = std::strtod(s, &end);
+        if (end == s)
+            break;
+        values[count++] = value;
+        s = end;
+    }
+    return count;
+}
+
+/*
+    Parse an OBJ index, 1 based or negative from the end of the count elements read so far, into a 0 based
+    index. Missing indices become -1. Returns false for indices out of range
+*/
+static bool parse_obj_index(const char*& s, size_t count, int& index)
+{
+    char* end;
+    long value = std::strtol(s, &end, 10);
+    if (end == s) {
+        index = -1;
+        return true;
+    }
+    s = end;
+
+    long resolved = value > 0 ? value - 1 : static_cast<long>(count) + value;
+    if (value == 0 || resolved < 0 || resolved >= static_cast<long>(count))
+        return false;
+    index = static_cast<int>(resolved);
+    return true;
+}
+
+shared_ptr<TriangleMesh> load_obj(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Can't open OBJ file " << path << ".\n";
+        return nullptr;
+    }
+
+    /* Attributes as listed in the file */
+    std::vector<Point3> obj_positions;
+    std::vector<Vector3> obj_normals;
+    std::vector<Real> obj_uvs;
+
+    /* Mesh vertices, one per distinct combination of attribute indices */
+    std::vector<Point3> positions;
+    std::vector<Vector3> normals;
+    std::vector<Real> uvs;
+    std::vector<uint32_t> indices;
+    std::unordered_map<ObjVertexKey, uint32_t, ObjVertexKeyHash> vertex_map;
+    bool has_normals = false, has_uvs = false;
+
+    std::string line;
+    std::vector<uint32_t> face;
+    size_t line_number = 0, skipped_faces = 0;
+
+    while (std::getline(file, line)) {
+        line_number++;
+        const char* s = skip_spaces(line.c_str());
+        Real values[3] = { 0, 0, 0 };
+
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            if (parse_reals(s + 2, values, 3) < 3)
+                std::cerr << path << ":" << line_number << ": vertex with less than 3 coordinates.\n";
+            obj_positions.emplace_back(values[0], values[1], values[2]);
+        } else if (s[0] == 'v' && s[1] == 'n' && (s[2] == ' ' || s[2] == '\t')) {
+            parse_reals(s + 3, values, 3);
+            obj_normals.emplace_back(values[0], values[1], values[2]);
+        } else if (s[0] == 'v' && s[1] == 't' && (s[2] == ' ' || s[2] == '\t')) {
+            parse_reals(s + 3, values, 2);
+            obj_uvs.push_back(values[0]);
+            obj_uvs.push_back(values[1]);
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            face.clear();
+            bool valid = true;
+            s = skip_spaces(s + 2);
+
+            /* Each vertex is v, v/vt, v//vn or v/vt/vn */
+            while (*s && *s != '\r' && *s != '#') {
+                ObjVertexKey key = { -1, -1, -1 };
+                valid &= parse_obj_index(s, obj_positions.size(), key.position_) && key.position_ >= 0;
+                if (*s == '/') {
+                    s++;
+                    valid &= parse_obj_index(s, obj_uvs.size() / 2, key.uv_);
+                    if (*s == '/') {
+                        s++;
+                        valid &= parse_obj_index(s, obj_normals.size(), key.normal_);
+                    }
+                }
+                if (!valid)
+                    break;
+
+                auto inserted = vertex_map.emplace(key, static_cast<uint32_t>(positions.size()));
+                if (inserted.second) {
+                    positions.push_back(obj_positions[key.position_]);
+                    normals.push_back(key.normal_ >= 0 ? obj_normals[key.normal_] : Vector3(0, 0, 0));
+                    uvs.push_back(key.uv_ >= 0 ? obj_uvs[2 * key.uv_] : 0);
+                    uvs.push_back(key.uv_ >= 0 ? obj_uvs[2 * key.uv_ + 1] : 0);
+                    has_normals |= key.normal_ >= 0;
+                    has_uvs |= key.uv_ >= 0;
+                }
+                face.push_back(inserted.first->second);
+
+                while (*s && *s != ' ' && *s != '\t' && *s != '\r')
+                    s++;
+                s = skip_spaces(s);
+            }
+
+            if (!valid || face.size() < 3) {
+                skipped_faces++;
+                continue;
+            }
+
+            for (size_t k = 1; k + 1 < face.size(); k++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[k]);
+                indices.push_back(face[k + 1]);
+            }
+        }
+    }
+
+    if (skipped_faces > 0)
+        std::cerr << path << ": skipped " << skipped_faces << " faces with invalid indices.\n";
+
+    if (!has_normals)
+        normals.clear();
+    if (!has_uvs)
+        uvs.clear();
+
+    return make_shared<TriangleMesh>(std::move(positions), std::move(indices), mat, std::move(normals), std::move(uvs), options);
+}
+
+
+enum class PlyType {
+    INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID
+};
+
+static PlyType ply_type(const std::string& name)
+{
+    if (name == "char" || name == "int8") return PlyType::INT8;
+    if (name == "uchar" || name == "uint8") return PlyType::UINT8;
+    if (name == "short" || name == "int16") return PlyType::INT16;
+    if (name == "ushort" || name == "uint16") return PlyType::UINT16;
+    if (name == "int" || name == "int32") return PlyType::INT32;
+    if (name == "uint" || name == "uint32") return PlyType::UINT32;
+    if (name == "float" || name == "float32") return PlyType::FLOAT32;
+    if (name == "double" || name == "float64") return PlyType::FLOAT64;
+    return PlyType::INVALID;
+}
+
+static size_t ply_type_size(PlyType type)
+{
+    switch (type) {
+    case PlyType::INT8: case PlyType::UINT8: return 1;
+    case PlyType::INT16: case PlyType::UINT16: return 2;
+    case PlyType::INT32: case PlyType::UINT32: case PlyType::FLOAT32: return 4;
+    case PlyType::FLOAT64: return 8;
+    default: return 0;
+    }
+}
+
+/* Read a value of type from data, reversing the bytes when the file endianness differs */
+static double ply_value(const unsigned char* data, PlyType type, bool swap)
+{
+    unsigned char bytes[8];
+    size_t size = ply_type_size(type);
+    for (size_t i = 0; i < size; i++)
+        bytes[i] = swap ? data[size - 1 - i] : data[i];
+
+    switch (type) {
+    case PlyType::INT8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::UINT8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::INT16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::UINT16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::INT32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::UINT32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::FLOAT32: { float v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::FLOAT64: { double v; std::memcpy(&v, bytes, 8); return v; }
+    default: return 0;
+    }
+}
+
+struct PlyProperty {
+    std::string name_;
+    PlyType type_;
+    /* List properties: type of the item count, the items are of type_ */
+    bool is_list_ = false;
+    PlyType count_type_ = PlyType::INVALID;
+};
+
+struct PlyElement {
+    std::string name_;
+    size_t count_;
+    std::vector<PlyProperty> properties_;
+};
+
+/* Hands out the bytes of a stream from a large buffer, so that the many small reads don't each go to the stream */
+class PlyReader {
+public:
+    PlyReader(std::istream& in) : in_(in), buffer_(1 << 20) {}
+
+    /* The next n bytes, or null past the end of the stream */
+    const unsigned char* read(size_t n) {
+        if (end_ - pos_ < n) {
+            std::memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+            end_ -= pos_;
+            pos_ = 0;
+            if (n > buffer_.size())
+                buffer_.resize(n);
+            in_.read(reinterpret_cast<char*>(buffer_.data() + end_), buffer_.size() - end_);
+            end_ += static_cast<size_t>(in_.gcount());
+            if (end_ - pos_ < n)
+                return nullptr;
+        }
+        const unsigned char* data = buffer_.data() + pos_;
+        pos_ += n;
+        return data;
+    }
+
+private:
+    std::istream& in_;
+    std::vector<unsigned char> buffer_;
+    size_t pos_ = 0, end_ = 0;
+};
+
+static int find_property(const PlyElement& element, std::initializer_list<const char*> names)
+{
+    for (const char* name : names) {
+        for (size_t i = 0; i < element.properties_.size(); i++) {
+            if (element.properties_[i].name_ == name)
+                return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+shared_ptr<TriangleMesh> load_ply(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Can't open PLY file " << path << ".\n";
+        return nullptr;
+    }
+
+    /* Header */
+    std::string line;
+    std::vector<PlyElement> elements;
+    bool little_endian = true, has_format = false;
+    std::getline(file, line);
+    if (line.compare(0, 3, "ply") != 0) {
+        std::cerr << path << " is not a PLY file.\n";
+        return nullptr;
+    }
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format != "binary_little_endian" && format != "binary_big_endian") {
+                std::cerr << path << ": only binary PLY files are supported.\n";
+                return nullptr;
+            }
+            little_endian = format == "binary_little_endian";
+            has_format = true;
+        } else if (keyword == "element") {
+            PlyElement element;
+            tokens >> element.name_ >> element.count_;
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                std::cerr << path << ": property before any element.\n";
+                return nullptr;
+            }
+            PlyProperty property;
+            std::string type;
+            tokens >> type;
+            if (type == "list") {
+                std::string count_type;
+                property.is_list_ = true;
+                tokens >> count_type >> type;
+                property.count_type_ = ply_type(count_type);
+                if (property.count_type_ == PlyType::INVALID) {
+                    std::cerr << path << ": unknown property type " << count_type << ".\n";
+                    return nullptr;
+                }
+            }
+            property.type_ = ply_type(type);
+            if (property.type_ == PlyType::INVALID) {
+                std::cerr << path << ": unknown property type " << type << ".\n";
+                return nullptr;
+            }
+            tokens >> property.name_;
+            elements.back().properties_.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    if (!has_format) {
+        std::cerr << path << ": missing PLY format.\n";
+        return nullptr;
+    }
+
+    const uint16_t probe = 1;
+    bool host_little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    bool swap = little_endian != host_little_endian;
+
+    std::vector<Point3> positions;
+    std::vector<Vector3> normals;
+    std::vector<Real> uvs;
+    std::vector<uint32_t> indices;
+    bool has_normals = false, has_uvs = false;
+    size_t skipped_faces = 0;
+
+    PlyReader reader(file);
+    std::vector<double> values;
+    std::vector<uint32_t> face;
+
+    for (const PlyElement& element : elements) {
+        int x = -1, y = -1, z = -1, nx = -1, ny = -1, nz = -1, u = -1, v = -1, face_indices = -1;
+        if (element.name_ == "vertex") {
+            x = find_property(element, { "x" });
+            y = find_property(element, { "y" });
+            z = find_property(element, { "z" });
+            nx = find_property(element, { "nx" });
+            ny = find_property(element, { "ny" });
+            nz = find_property(element, { "nz" });
+            u = find_property(element, { "u", "s", "texture_u" });
+            v = find_property(element, { "v", "t", "texture_v" });
+            if (x < 0 || y < 0 || z < 0) {
+                std::cerr << path << ": vertices without positions.\n";
+                return nullptr;
+            }
+            has_normals = nx >= 0 && ny >= 0 && nz >= 0;
+            has_uvs = u >= 0 && v >= 0;
+            positions.reserve(element.count_);
+            normals.reserve(has_normals ? element.count_ : 0);
+            uvs.reserve(has_uvs ? 2 * element.count_ : 0);
+        } else if (element.name_ == "face") {
+            face_indices = find_property(element, { "vertex_indices", "vertex_index" });
+            indices.reserve(3 * element.count_);
+        }
+
+        /* Every element is read through, also the ones that are not used, to get to the next */
+        values.resize(element.properties_.size());
+        for (size_t e = 0; e < element.count_; e++) {
+            for (size_t p = 0; p < element.properties_.size(); p++) {
+                const PlyProperty& property = element.properties_[p];
+                size_t type_size = ply_type_size(property.type_);
+
+                if (!property.is_list_) {
+                    const unsigned char* data = reader.read(type_size);
+                    if (!data) {
+                        std::cerr << path << ": unexpected end of file.\n";
+                        return nullptr;
+                    }
+                    values[p] = ply_value(data, property.type_, swap);
+                    continue;
+                }
+
+                const unsigned char* count_data = reader.read(ply_type_size(property.count_type_));
+                const unsigned char* data = count_data ? reader.read(static_cast<size_t>(ply_value(count_data, property.count_type_, swap)) * type_size) : nullptr;
+                if (!data) {
+                    std::cerr << path << ": unexpected end of file.\n";
+                    return nullptr;
+                }
+
+                if (static_cast<int>(p) == face_indices) {
+                    size_t count = static_cast<size_t>(ply_value(count_data, property.count_type_, swap));
+                    face.clear();
+                    for (size_t i = 0; i < count; i++)
+                        face.push_back(static_cast<uint32_t>(ply_value(data + i * type_size, property.type_, swap)));
+                }
+            }
+
+            if (x >= 0) {
+                positions.emplace_back(values[x], values[y], values[z]);
+                if (has_normals)
+                    normals.emplace_back(values[nx], values[ny], values[nz]);
+                if (has_uvs) {
+                    uvs.push_back(values[u]);
+                    uvs.push_back(values[v]);
+                }
+            } else if (face_indices >= 0) {
+                bool valid = face.size() >= 3;
+                for (uint32_t index : face)
+                    valid &= index < positions.size();
+                if (!valid) {
+                    skipped_faces++;
+                    continue;
+                }
+                for (size_t k = 1; k + 1 < face.size(); k++) {
+                    indices.push_back(face[0]);
+                    indices.push_back(face[k]);
+                    indices.push_back(face[k + 1]);
+                }
+            }
+        }
+    }
+
+    if (skipped_faces > 0)
+        std::cerr << path << ": skipped " << skipped_faces << " faces with invalid indices.\n";
+
+    return make_shared<TriangleMesh>(std::move(positions), std::move(indices), mat, std::move(normals), std::move(uvs), options);
+}
+
+shared_ptr<TriangleMesh> load_mesh(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options)
+{
+    std::string extension = path.substr(path.find_last_of('.') == std::string::npos ? path.size() : path.find_last_of('.'));
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    if (extension == ".obj")
+        return load_obj(path, mat, options);
+    if (extension == ".ply")
+        return load_ply(path, mat, options);
+
+    std::cerr << "Unknown mesh format " << path << ".\n";
+    return nullptr;
+}
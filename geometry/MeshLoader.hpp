@@ -0,0 +1,26 @@
+#ifndef __MeshLoader_hpp__
+#define __MeshLoader_hpp__
+
+#include "Common.hpp"
+#include "TriangleMesh.hpp"
+
+#include <string>
+
+/*
+    Load the triangles of a Wavefront OBJ file, read one line at a time. Polygons are split into fans, vertices
+    with different normal or texture coordinate indices become separate mesh vertices. Groups and materials
+    are ignored, the whole file gets mat. Returns null if the file can't be read
+*/
+shared_ptr<TriangleMesh> load_obj(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options = BVHBuildOptions());
+
+/*
+    Load a binary PLY file, little or big endian, read one element at a time. Uses the vertex positions, and
+    the normals (nx ny nz) and texture coordinates (u v, s t or texture_u texture_v) if present. Faces are
+    split into fans. Returns null if the file can't be read or isn't a supported PLY
+*/
+shared_ptr<TriangleMesh> load_ply(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options = BVHBuildOptions());
+
+/* Load an .obj or .ply file, picked by the extension */
+shared_ptr<TriangleMesh> load_mesh(const std::string& path, shared_ptr<Material> mat, const BVHBuildOptions& options = BVHBuildOptions());
+
+#endif
@@ -0,0 +1,290 @@
+#include "QuadBatch.hpp"
+#include "math/Simd.hpp"
+
+#include <algorithm>
+#include <type_traits>
+
+void QuadBatch::add(const Point3 & q, const Vector3 & u, const Vector3 & v, shared_ptr<Material> mat, bool flip_normal)
+{
+    /* Drop the padding of an earlier build */
+    size_t n = material_.size();
+    for (int a = 0; a < 3; a++) {
+        q_[a].resize(n);
+        u_[a].resize(n);
+        v_[a].resize(n);
+        normal_[a].resize(n);
+        w_[a].resize(n);
+    }
+    d_.resize(n);
+
+    Vector3 uv = cross(u, v);
+    Vector3 normal = unit_vector(uv);
+    if (flip_normal)
+        normal = -normal;
+    Vector3 w = uv / uv.length_squared();
+
+    for (int a = 0; a < 3; a++) {
+        q_[a].push_back(q[a]);
+        u_[a].push_back(u[a]);
+        v_[a].push_back(v[a]);
+        normal_[a].push_back(normal[a]);
+        w_[a].push_back(w[a]);
+    }
+    d_.push_back(dot(normal, q));
+
+    auto inserted = material_index_.emplace(mat.get(), static_cast<uint32_t>(materials_.size()));
+    if (inserted.second)
+        materials_.push_back(mat);
+    material_.push_back(inserted.first->second);
+}
+
+void QuadBatch::build(const BVHBuildOptions & options)
+{
+    size_t n = material_.size();
+    nodes_.clear();
+    area_cdf_.clear();
+    if (n == 0)
+        return;
+
+    std::vector<BVHPrimitiveInfo> prims(n);
+    for (size_t i = 0; i < n; i++) {
+        Point3 q(q_[0][i], q_[1][i], q_[2][i]);
+        Vector3 u(u_[0][i], u_[1][i], u_[2][i]);
+        Vector3 v(v_[0][i], v_[1][i], v_[2][i]);
+        AABB bounds(q, q);
+        bounds.expand(q + u);
+        bounds.expand(q + v);
+        bounds.expand(q + u + v);
+
+        /* Flat boxes are padded like the rectangles, a slab of zero width is never hit */
+        for (int a = 0; a < 3; a++) {
+            if (bounds.max_.e[a] - bounds.min_.e[a] < 0.0001) {
+                bounds.min_.e[a] -= 0.0001;
+                bounds.max_.e[a] += 0.0001;
+            }
+        }
+
+        prims[i].index_ = i;
+        prims[i].bounds_ = bounds;
+        prims[i].centroid_ = bounds.centroid();
+    }
+
+    /* A SIMD group costs about as much as a single quad, so leaves can hold a few groups */
+    BVHBuildOptions build_options = LinearBVH::build_options(options);
+    build_options.max_leaf_size_ = std::max<size_t>(build_options.max_leaf_size_, 2 * simd_width);
+    build_options.intersection_cost_ = options.intersection_cost_ / simd_width;
+
+    auto root = bvh_build(prims, build_options);
+    linear_bvh_flatten(*root, nodes_);
+
+    /* Reorder into leaf order, quads referenced by more than one leaf are copied */
+    auto reorder = [&](auto& values, auto padding) {
+        std::remove_reference_t<decltype(values)> ordered;
+        ordered.reserve(prims.size() + simd_width);
+        for (const auto& prim : prims)
+            ordered.push_back(values[prim.index_]);
+        values.swap(ordered);
+        values.resize(prims.size() + padding, 0);
+    };
+    for (int a = 0; a < 3; a++) {
+        reorder(q_[a], simd_width);
+        reorder(u_[a], simd_width);
+        reorder(v_[a], simd_width);
+        reorder(normal_[a], simd_width);
+        reorder(w_[a], simd_width);
+    }
+    reorder(d_, simd_width);
+    reorder(material_, 0);
+
+    /* Copies of the same quad share its area, so the sampling density stays uniform */
+    std::vector<size_t> references(n, 0);
+    for (const auto& prim : prims)
+        references[prim.index_]++;
+
+    source_.clear();
+    copies_.clear();
+    for (const auto& prim : prims) {
+        source_.push_back(static_cast<uint32_t>(prim.index_));
+        copies_.push_back(static_cast<uint32_t>(references[prim.index_]));
+    }
+
+    Real total = 0;
+    area_cdf_.reserve(prims.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        Vector3 u(u_[0][i], u_[1][i], u_[2][i]);
+        Vector3 v(v_[0][i], v_[1][i], v_[2][i]);
+        total += cross(u, v).length() / references[prims[i].index_];
+        area_cdf_.push_back(total);
+    }
+}
+
+/*
+    Intersect the ray with the quads [first, last), a SIMD group at a time. Returns the index of the closest
+    quad hit within [t_min, t_closest], and shrinks t_closest to its distance, or returns -1. With any_hit,
+    returns the first quad found. The bounds are inclusive, like the rectangles
+*/
+template<bool any_hit>
+static inline long quads_hit(const QuadBatch& batch, const Ray& r, size_t first, size_t last, Real t_min, Real& t_closest)
+{
+    SimdReal ox(r.origin_.x()), oy(r.origin_.y()), oz(r.origin_.z());
+    SimdReal dx(r.direction_.x()), dy(r.direction_.y()), dz(r.direction_.z());
+    SimdReal lo(t_min), zero(0.0), one(1.0);
+    long closest = -1;
+
+    for (size_t i = first; i < last; i += simd_width) {
+        SimdReal nx = SimdReal::load(batch.normal_[0].data() + i);
+        SimdReal ny = SimdReal::load(batch.normal_[1].data() + i);
+        SimdReal nz = SimdReal::load(batch.normal_[2].data() + i);
+
+        /* Distance to the plane, rays parallel to it miss */
+        SimdReal denom = nx * dx + ny * dy + nz * dz;
+        SimdReal t = (SimdReal::load(batch.d_.data() + i) - (nx * ox + ny * oy + nz * oz)) / denom;
+        SimdMask in_range = (abs(denom) > zero) & (t >= lo) & (t <= SimdReal(t_closest));
+
+        int lanes = simd_lanes_below(static_cast<int>(last - i));
+        if ((in_range.bits() & lanes) == 0)
+            continue;
+
+        /* Point on the plane relative to the corner, and its coordinates along the edges */
+        SimdReal hx = ox + t * dx - SimdReal::load(batch.q_[0].data() + i);
+        SimdReal hy = oy + t * dy - SimdReal::load(batch.q_[1].data() + i);
+        SimdReal hz = oz + t * dz - SimdReal::load(batch.q_[2].data() + i);
+        SimdReal ux = SimdReal::load(batch.u_[0].data() + i), uy = SimdReal::load(batch.u_[1].data() + i), uz = SimdReal::load(batch.u_[2].data() + i);
+        SimdReal vx = SimdReal::load(batch.v_[0].data() + i), vy = SimdReal::load(batch.v_[1].data() + i), vz = SimdReal::load(batch.v_[2].data() + i);
+        SimdReal wx = SimdReal::load(batch.w_[0].data() + i), wy = SimdReal::load(batch.w_[1].data() + i), wz = SimdReal::load(batch.w_[2].data() + i);
+
+        SimdReal alpha = wx * (hy * vz - hz * vy) + wy * (hz * vx - hx * vz) + wz * (hx * vy - hy * vx);
+        SimdReal beta = wx * (uy * hz - uz * hy) + wy * (uz * hx - ux * hz) + wz * (ux * hy - uy * hx);
+        SimdMask inside = in_range & (alpha >= zero) & (alpha <= one) & (beta >= zero) & (beta <= one);
+        int hits = inside.bits() & lanes;
+        if (hits == 0)
+            continue;
+
+        Real t_lanes[simd_width];
+        t.store(t_lanes);
+        for (int lane = 0; lane < simd_width; lane++) {
+            if (!(hits >> lane & 1) || t_lanes[lane] > t_closest || (closest >= 0 && t_lanes[lane] == t_closest))
+                continue;
+            t_closest = t_lanes[lane];
+            closest = static_cast<long>(i + lane);
+            if (any_hit)
+                return closest;
+        }
+    }
+
+    return closest;
+}
+
+bool QuadBatch::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    if (!QuadBatch::intersect(r, t_min, t_max, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool QuadBatch::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    long closest = -1;
+    Real t_hit = t_max;
+    bool found = linear_bvh_traverse(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        long quad = quads_hit<false>(*this, r, offset, offset + count, t_min, t_closest);
+        if (quad < 0)
+            return false;
+        closest = quad;
+        t_hit = t_closest;
+        return true;
+    });
+
+    if (!found)
+        return false;
+
+    rec.t_ = t_hit;
+    rec.primitive_ = static_cast<uint32_t>(closest);
+    rec.object_ = this;
+    return true;
+}
+
+void QuadBatch::finalize(const Ray & r, HitRecord & rec) const
+{
+    uint32_t closest = rec.primitive_;
+    rec.p_ = r.at(rec.t_);
+
+    /* The uv coordinates of the closest quad, in scalar */
+    Vector3 h = rec.p_ - Point3(q_[0][closest], q_[1][closest], q_[2][closest]);
+    Vector3 u(u_[0][closest], u_[1][closest], u_[2][closest]);
+    Vector3 v(v_[0][closest], v_[1][closest], v_[2][closest]);
+    Vector3 w(w_[0][closest], w_[1][closest], w_[2][closest]);
+    rec.u_ = dot(w, cross(h, v));
+    rec.v_ = dot(w, cross(u, h));
+
+    rec.SetFaceNormal(r, Vector3(normal_[0][closest], normal_[1][closest], normal_[2][closest]));
+    rec.mat_ = materials_[material_[closest]].get();
+}
+
+bool QuadBatch::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        return quads_hit<true>(*this, r, offset, offset + count, t_min, t_closest) >= 0;
+    });
+}
+
+bool QuadBatch::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
+
+double QuadBatch::pdf_value(const Point3 & o, const Vector3 & v) const
+{
+    if (area_cdf_.empty())
+        return 0;
+
+    /*
+        Every quad along the direction could have been sampled, the leaves never report a hit so all are visited.
+        A quad split by the build can be found in several leaves, it is counted once
+    */
+    Ray r(o, v);
+    Real total_area = area();
+    Real pdf = 0;
+    std::vector<uint32_t> counted;
+    linear_bvh_traverse(nodes_.data(), nodes_.size(), r, 0.001, infinity, [&](uint32_t offset, uint32_t count, Real&) {
+        for (uint32_t i = offset; i < offset + count; i++) {
+            Real t_closest = infinity;
+            if (quads_hit<true>(*this, r, i, i + 1, 0.001, t_closest) < 0)
+                continue;
+            if (copies_[i] > 1) {
+                if (std::find(counted.begin(), counted.end(), source_[i]) != counted.end())
+                    continue;
+                counted.push_back(source_[i]);
+            }
+
+            /* The area density is 1 / total_area on every quad, converted to solid angle */
+            auto distance_squared = t_closest * t_closest * v.length_squared();
+            auto cosine = fabs(normal_[0][i] * v.x() + normal_[1][i] * v.y() + normal_[2][i] * v.z()) / v.length();
+            pdf += distance_squared / (cosine * total_area);
+        }
+        return false;
+    });
+
+    return pdf;
+}
+
+Point3 QuadBatch::sample(Real s0, Real s1, Real s2, Vector3 & normal) const
+{
+    auto it = std::upper_bound(area_cdf_.begin(), area_cdf_.end(), s0 * area());
+    size_t i = std::min<size_t>(it - area_cdf_.begin(), area_cdf_.size() - 1);
+
+    normal = Vector3(normal_[0][i], normal_[1][i], normal_[2][i]);
+    return Point3(q_[0][i], q_[1][i], q_[2][i]) + s1 * Vector3(u_[0][i], u_[1][i], u_[2][i]) + s2 * Vector3(v_[0][i], v_[1][i], v_[2][i]);
+}
+
+Vector3 QuadBatch::random(const Point3 & o) const
+{
+    Vector3 normal;
+    return sample(random_double(), random_double(), random_double(), normal) - o;
+}
@@ -0,0 +1,99 @@
+#ifndef __QuadBatch_hpp__
+#define __QuadBatch_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Many parallelograms as a single object, stored as arrays per component. Like SphereBatch, the batch keeps
+    its own BVH, whose leaves test their quads a SIMD group at a time, and the hit record is only filled for
+    the closest quad. The axis aligned rectangles are quads too, with the same normals and uv coordinates as
+    XYRect, XZRect and YZRect.
+
+    As a light, the batch is sampled uniformly by area over all its quads
+*/
+class QuadBatch : public Hittable {
+public:
+    QuadBatch() {};
+
+    /*
+        The parallelogram q + a u + b v, for a and b in [0, 1], which are also its uv coordinates. The normal
+        is cross(u, v), or the opposite with flip_normal
+    */
+    void add(const Point3& q, const Vector3& u, const Vector3& v, shared_ptr<Material> mat, bool flip_normal = false);
+
+    void add_xy_rect(Real x0, Real x1, Real y0, Real y1, Real k, shared_ptr<Material> mat, bool flip_normal = false) {
+        add(Point3(x0, y0, k), Vector3(x1 - x0, 0, 0), Vector3(0, y1 - y0, 0), mat, flip_normal);
+    }
+    void add_xz_rect(Real x0, Real x1, Real z0, Real z1, Real k, shared_ptr<Material> mat, bool flip_normal = false) {
+        /* cross(x, z) is -y, XZRect faces +y */
+        add(Point3(x0, k, z0), Vector3(x1 - x0, 0, 0), Vector3(0, 0, z1 - z0), mat, !flip_normal);
+    }
+    void add_yz_rect(Real y0, Real y1, Real z0, Real z1, Real k, shared_ptr<Material> mat, bool flip_normal = false) {
+        add(Point3(k, y0, z0), Vector3(0, y1 - y0, 0), Vector3(0, 0, z1 - z0), mat, flip_normal);
+    }
+
+    /* Build the BVH over the quads added so far. Needed before any hit or sample */
+    void build(const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
+    /*
+        Solid angle density of sampling direction v from o, with points picked uniformly by area. Adds up
+        the density of every quad along v
+    */
+    virtual double pdf_value(const Point3& o, const Vector3& v) const override;
+
+    /* Direction from o to a point picked uniformly by area */
+    virtual Vector3 random(const Point3& o) const override;
+
+    /* Point picked uniformly by area from the random numbers s0, s1 and s2 in [0, 1), with the outward normal there */
+    Point3 sample(Real s0, Real s1, Real s2, Vector3& normal) const;
+
+    Real area() const {
+        return area_cdf_.empty() ? 0 : area_cdf_.back();
+    }
+
+    size_t size() const {
+        return material_.size();
+    }
+
+public:
+    /*
+        Per quad: corner, edges, outward unit normal, plane offset dot(normal, q), and cross(u, v) divided
+        by its squared length, which turns a point on the plane into its uv coordinates. Ordered so that
+        every leaf references a contiguous range after the build, which also pads these arrays with a SIMD
+        group of empty quads
+    */
+    std::vector<Real> q_[3];
+    std::vector<Real> u_[3];
+    std::vector<Real> v_[3];
+    std::vector<Real> normal_[3];
+    std::vector<Real> d_;
+    std::vector<Real> w_[3];
+    /* Index into materials_ */
+    std::vector<uint32_t> material_;
+    std::vector<shared_ptr<Material>> materials_;
+    std::vector<LinearBVHNode> nodes_;
+    /* Running sum of the quad areas, in quad order */
+    std::vector<Real> area_cdf_;
+    /* Per quad after the build: the index it was added at, and the number of leaves referencing it */
+    std::vector<uint32_t> source_;
+    std::vector<uint32_t> copies_;
+
+private:
+    std::unordered_map<const Material*, uint32_t> material_index_;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "SDF.hpp"
+#include "Sphere.hpp"
+
+Real SDFBox::distance(const Point3 & p) const
+{
+    /* Per axis distance outside the box, negative inside */
+    Vector3 q(fabs(p.x()) - half_size_.x(), fabs(p.y()) - half_size_.y(), fabs(p.z()) - half_size_.z());
+    Vector3 outside(fmax(q.x(), 0.0), fmax(q.y(), 0.0), fmax(q.z(), 0.0));
+    Real inside = fmin(fmax(q.x(), fmax(q.y(), q.z())), 0.0);
+    return outside.length() + inside - radius_;
+}
+
+AABB SDFTranslate::bounds() const
+{
+    AABB box = child_->bounds();
+    return AABB(box.min() + offset_, box.max() + offset_);
+}
+
+Real SDFSmoothUnion::distance(const Point3 & p) const
+{
+    Real a = a_->distance(p);
+    Real b = b_->distance(p);
+    if (blend_ <= 0)
+        return fmin(a, b);
+
+    Real h = fmax(blend_ - fabs(a - b), 0.0) / blend_;
+    return fmin(a, b) - h * h * blend_ * 0.25;
+}
+
+AABB SDFSmoothUnion::bounds() const
+{
+    AABB box = AABB::surrounding_box(a_->bounds(), b_->bounds());
+    Vector3 blend(0.25 * blend_, 0.25 * blend_, 0.25 * blend_);
+    return AABB(box.min() - blend, box.max() + blend);
+}
+
+Real SDFRepeat::distance(const Point3 & p) const
+{
+    /* The point relative to the center of the nearest cell */
+    Point3 q = p;
+    for (int a = 0; a < 3; a++) {
+        if (period_[a] <= 0)
+            continue;
+        Real cell = std::round(p[a] / period_[a]);
+        if (count_ > 0)
+            cell = clamp(cell, -count_, count_);
+        q[a] = p[a] - period_[a] * cell;
+    }
+    return child_->distance(q);
+}
+
+AABB SDFRepeat::bounds() const
+{
+    AABB box = child_->bounds();
+    Point3 min = box.min();
+    Point3 max = box.max();
+    for (int a = 0; a < 3; a++) {
+        if (period_[a] <= 0)
+            continue;
+        min[a] = count_ > 0 ? min[a] - count_ * period_[a] : -infinity;
+        max[a] = count_ > 0 ? max[a] + count_ * period_[a] : infinity;
+    }
+    return AABB(min, max);
+}
+
+AABB SDFDisplace::bounds() const
+{
+    AABB box = child_->bounds();
+    Vector3 bump(fabs(amplitude_), fabs(amplitude_), fabs(amplitude_));
+    return AABB(box.min() - bump, box.max() + bump);
+}
+
+SDFObject::SDFObject(shared_ptr<SDF> sdf, shared_ptr<Material> mat)
+    : SDFObject(sdf, mat, AABB(Point3(-infinity, -infinity, -infinity), Point3(infinity, infinity, infinity)))
+{
+}
+
+SDFObject::SDFObject(shared_ptr<SDF> sdf, shared_ptr<Material> mat, const AABB & clip) : sdf_(sdf), mat_(mat)
+{
+    AABB box = sdf_->bounds();
+    Point3 min, max;
+    for (int a = 0; a < 3; a++) {
+        min[a] = fmax(box.min()[a], clip.min()[a]);
+        max[a] = fmin(box.max()[a], clip.max()[a]);
+    }
+    bbox_ = AABB(min, max);
+    lipschitz_ = sdf_->lipschitz();
+
+    Vector3 diagonal = max - min;
+    if (!std::isfinite(diagonal.length_squared())) {
+        std::cerr << "SDFObject: unbounded field, give it a clip box.\n";
+        bbox_ = AABB::empty();
+        bounded_ = false;
+        diagonal = Vector3(0, 0, 0);
+    }
+    epsilon_ = 1e-5 * fmax(diagonal.length(), 1e-3);
+}
+
+bool SDFObject::trace(const Ray & r, Real t_min, Real t_max, Real & t) const
+{
+    /* Only the part of the ray inside the bounds is traced */
+    Real t_start = t_min;
+    const Point3* planes[2] = { &bbox_.min_, &bbox_.max_ };
+    for (int a = 0; a < 3; a++) {
+        int neg = r.dir_is_neg_[a];
+        slab_clip(planes[neg]->e[a], planes[1 - neg]->e[a], r.origin_.e[a], r.inv_direction_.e[a], t_min, t_max);
+    }
+    if (!(t_min < t_max))
+        return false;
+
+    /* A step of the distance divided by the Lipschitz bound stays on the side of the surface it started on */
+    Real step_scale = 1 / (lipschitz_ * r.direction().length());
+
+    t = t_min;
+    Real d = sdf_->distance(r.at(t));
+
+    /*
+        The side of the surface the ray travels on. A ray that starts on the surface, like a scattered ray,
+        travels on the side it leaves to, and the surface it starts on is not reported. A ray that enters the
+        bounds on the surface hits it there
+    */
+    bool leaving = t_min == t_start && fabs(d) <= epsilon_;
+    Real side = leaving ? (dot(normal(r.at(t)), r.direction()) > 0 ? 1 : -1) : (d > 0 ? 1 : -1);
+
+    for (int step = 0; step < max_steps_; step++) {
+        Real distance = side * d;
+        if (leaving)
+            leaving = distance < epsilon_;
+        else if (distance < epsilon_)
+            return true;
+
+        t += fmax(distance, epsilon_) * step_scale;
+        if (t > t_max)
+            return false;
+        d = sdf_->distance(r.at(t));
+    }
+
+    return false;
+}
+
+bool SDFObject::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    if (!SDFObject::intersect(r, t_min, t_max, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool SDFObject::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    Real t;
+    if (!trace(r, t_min, t_max, t))
+        return false;
+
+    rec.t_ = t;
+    rec.object_ = this;
+    return true;
+}
+
+void SDFObject::finalize(const Ray & r, HitRecord & rec) const
+{
+    rec.p_ = r.at(rec.t_);
+    Vector3 outward_normal = normal(rec.p_);
+    rec.SetFaceNormal(r, outward_normal);
+    /* Fields have no parametrization, textures are mapped by direction like on a sphere */
+    GetSphereUV(outward_normal, rec.u_, rec.v_);
+    rec.mat_ = mat_.get();
+}
+
+bool SDFObject::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    Real t;
+    return trace(r, t_min, t_max, t);
+}
+
+bool SDFObject::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    output_box = bbox_;
+    return bounded_;
+}
+
+Vector3 SDFObject::normal(const Point3 & p) const
+{
+    /* Gradient from four samples on the corners of a tetrahedron around p */
+    const Real h = epsilon_;
+    const Vector3 k0(1, -1, -1), k1(-1, -1, 1), k2(-1, 1, -1), k3(1, 1, 1);
+    Vector3 gradient = k0 * sdf_->distance(p + h * k0) + k1 * sdf_->distance(p + h * k1)
+        + k2 * sdf_->distance(p + h * k2) + k3 * sdf_->distance(p + h * k3);
+
+    if (gradient.length_squared() == 0)
+        return Vector3(0, 1, 0);
+    return unit_vector(gradient);
+}
@@ -0,0 +1,256 @@
+#ifndef __SDF_hpp__
+#define __SDF_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+
+/*
+    A node of a signed distance field: negative inside the shape, positive outside. The distance may
+    underestimate the distance to the surface, and changes no faster than the Lipschitz bound allows:
+    |distance(p) - distance(q)| <= lipschitz() |p - q|. Shapes are centered on the origin, and placed with
+    SDFTranslate, or with an Instance around the SDFObject
+*/
+class SDF {
+public:
+    virtual ~SDF() {}
+
+    virtual Real distance(const Point3& p) const = 0;
+
+    /* Bounds of the region where the distance can be negative, infinite for unbounded fields */
+    virtual AABB bounds() const = 0;
+
+    virtual Real lipschitz() const {
+        return 1;
+    }
+};
+
+
+class SDFSphere : public SDF {
+public:
+    SDFSphere(Real radius) : radius_(radius) {}
+
+    virtual Real distance(const Point3& p) const override {
+        return p.length() - radius_;
+    }
+
+    virtual AABB bounds() const override {
+        return AABB(-Point3(radius_, radius_, radius_), Point3(radius_, radius_, radius_));
+    }
+
+public:
+    Real radius_;
+};
+
+
+/* Box from -half_size to half_size, with the edges rounded by radius */
+class SDFBox : public SDF {
+public:
+    SDFBox(const Vector3& half_size, Real radius = 0) : half_size_(half_size), radius_(radius) {}
+
+    virtual Real distance(const Point3& p) const override;
+
+    virtual AABB bounds() const override {
+        Vector3 extent = half_size_ + Vector3(radius_, radius_, radius_);
+        return AABB(-extent, extent);
+    }
+
+public:
+    Vector3 half_size_;
+    Real radius_;
+};
+
+
+/* Torus around the Y axis, major_radius from the axis to the center of the tube */
+class SDFTorus : public SDF {
+public:
+    SDFTorus(Real major_radius, Real minor_radius) : major_radius_(major_radius), minor_radius_(minor_radius) {}
+
+    virtual Real distance(const Point3& p) const override {
+        Real ring = sqrt(p.x() * p.x() + p.z() * p.z()) - major_radius_;
+        return sqrt(ring * ring + p.y() * p.y()) - minor_radius_;
+    }
+
+    virtual AABB bounds() const override {
+        Real r = major_radius_ + minor_radius_;
+        return AABB(Point3(-r, -minor_radius_, -r), Point3(r, minor_radius_, r));
+    }
+
+public:
+    Real major_radius_;
+    Real minor_radius_;
+};
+
+
+class SDFTranslate : public SDF {
+public:
+    SDFTranslate(shared_ptr<SDF> child, const Vector3& offset) : child_(child), offset_(offset) {}
+
+    virtual Real distance(const Point3& p) const override {
+        return child_->distance(p - offset_);
+    }
+
+    virtual AABB bounds() const override;
+
+    virtual Real lipschitz() const override {
+        return child_->lipschitz();
+    }
+
+public:
+    shared_ptr<SDF> child_;
+    Vector3 offset_;
+};
+
+
+class SDFUnion : public SDF {
+public:
+    SDFUnion(shared_ptr<SDF> a, shared_ptr<SDF> b) : a_(a), b_(b) {}
+
+    virtual Real distance(const Point3& p) const override {
+        return fmin(a_->distance(p), b_->distance(p));
+    }
+
+    virtual AABB bounds() const override {
+        return AABB::surrounding_box(a_->bounds(), b_->bounds());
+    }
+
+    virtual Real lipschitz() const override {
+        return fmax(a_->lipschitz(), b_->lipschitz());
+    }
+
+public:
+    shared_ptr<SDF> a_, b_;
+};
+
+
+/*
+    Union that blends the two shapes where they are closer than blend to each other, with the quadratic smooth
+    minimum. The blend only adds material, by at most blend / 4, and keeps the Lipschitz bound of the children
+*/
+class SDFSmoothUnion : public SDF {
+public:
+    SDFSmoothUnion(shared_ptr<SDF> a, shared_ptr<SDF> b, Real blend) : a_(a), b_(b), blend_(blend) {}
+
+    virtual Real distance(const Point3& p) const override;
+
+    virtual AABB bounds() const override;
+
+    virtual Real lipschitz() const override {
+        return fmax(a_->lipschitz(), b_->lipschitz());
+    }
+
+public:
+    shared_ptr<SDF> a_, b_;
+    Real blend_;
+};
+
+
+/* The shape a with b carved out of it */
+class SDFSubtraction : public SDF {
+public:
+    SDFSubtraction(shared_ptr<SDF> a, shared_ptr<SDF> b) : a_(a), b_(b) {}
+
+    virtual Real distance(const Point3& p) const override {
+        return fmax(a_->distance(p), -b_->distance(p));
+    }
+
+    virtual AABB bounds() const override {
+        return a_->bounds();
+    }
+
+    virtual Real lipschitz() const override {
+        return fmax(a_->lipschitz(), b_->lipschitz());
+    }
+
+public:
+    shared_ptr<SDF> a_, b_;
+};
+
+
+/*
+    Copies of the child every period along each axis, a period of 0 leaves that axis alone. With a count, the
+    copies stop count cells away from the origin on each side, otherwise they go on forever. Only the nearest
+    copy is evaluated, so the child must stay within its cell, half a period around the origin
+*/
+class SDFRepeat : public SDF {
+public:
+    SDFRepeat(shared_ptr<SDF> child, const Vector3& period, int count = 0) : child_(child), period_(period), count_(count) {}
+
+    virtual Real distance(const Point3& p) const override;
+
+    virtual AABB bounds() const override;
+
+    virtual Real lipschitz() const override {
+        return child_->lipschitz();
+    }
+
+public:
+    shared_ptr<SDF> child_;
+    Vector3 period_;
+    int count_;
+};
+
+
+/*
+    Procedural bumps on the surface: adds amplitude sin(f x) sin(f y) sin(f z). The gradient of the bumps is at
+    most amplitude f sqrt(3), which is added to the Lipschitz bound, so the tracing takes shorter steps
+*/
+class SDFDisplace : public SDF {
+public:
+    SDFDisplace(shared_ptr<SDF> child, Real amplitude, Real frequency) : child_(child), amplitude_(amplitude), frequency_(frequency) {}
+
+    virtual Real distance(const Point3& p) const override {
+        return child_->distance(p) + amplitude_ * sin(frequency_ * p.x()) * sin(frequency_ * p.y()) * sin(frequency_ * p.z());
+    }
+
+    virtual AABB bounds() const override;
+
+    virtual Real lipschitz() const override {
+        return child_->lipschitz() + fabs(amplitude_ * frequency_) * sqrt(3.0);
+    }
+
+public:
+    shared_ptr<SDF> child_;
+    Real amplitude_;
+    Real frequency_;
+};
+
+
+/*
+    A signed distance field as an object of the scene, intersected by sphere tracing: steps of the distance
+    divided by the Lipschitz bound never cross the surface. Unbounded fields are clipped to a box, which is
+    also the bounding box for the BVH. Normals are the gradient of the field, by finite differences
+*/
+class SDFObject : public Hittable {
+public:
+    SDFObject(shared_ptr<SDF> sdf, shared_ptr<Material> mat);
+
+    /* The field clipped to clip, needed for unbounded fields */
+    SDFObject(shared_ptr<SDF> sdf, shared_ptr<Material> mat, const AABB& clip);
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
+    /* Unit normal of the field at p */
+    Vector3 normal(const Point3& p) const;
+
+private:
+    /* Distance along r to the surface, traced within [t_min, t_max] */
+    bool trace(const Ray& r, Real t_min, Real t_max, Real& t) const;
+
+public:
+    shared_ptr<SDF> sdf_;
+    shared_ptr<Material> mat_;
+    AABB bbox_;
+    /* False for unbounded fields without a clip box, which are never hit */
+    bool bounded_ = true;
+    Real lipschitz_;
+    /* The surface is reached within this distance, relative to the size of the bounds */
+    Real epsilon_;
+    int max_steps_ = 512;
+};
+
+#endif
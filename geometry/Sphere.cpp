@@ -2,39 +2,20 @@
 
 bool Sphere::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    Vector3 oc = r.origin() - center_;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius_ * radius_;
-    auto discriminant = half_b * half_b - a * c;
+    if (!Sphere::intersect(r, t_min, t_max, rec))
+        return false;
 
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
-
-        auto temp = (-half_b - root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t_ = temp;
-            rec.p_ = r.at(rec.t_);
-            Vector3 outward_normal = (rec.p_ - center_) / radius_;
-            rec.SetFaceNormal(r, outward_normal);
-            GetSphereUV((rec.p_ - center_) / radius_, rec.u_, rec.v_);
-            rec.mat_ = mat_;
-            return true;
-        }
-
-        temp = (-half_b + root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t_ = temp;
-            rec.p_ = r.at(rec.t_);
-            Vector3 outward_normal = (rec.p_ - center_) / radius_;
-            rec.SetFaceNormal(r, outward_normal);
-            GetSphereUV((rec.p_ - center_) / radius_, rec.u_, rec.v_);
-            rec.mat_ = mat_;
-            return true;
-        }
-    }
+    finalize_hit(r, rec);
+    return true;
+}
 
-    return false;
+void Sphere::finalize(const Ray & r, HitRecord & rec) const
+{
+    rec.p_ = r.at(rec.t_);
+    Vector3 outward_normal = (rec.p_ - center_) / radius_;
+    rec.SetFaceNormal(r, outward_normal);
+    GetSphereUV(outward_normal, rec.u_, rec.v_);
+    rec.mat_ = mat_.get();
 }
 
 bool Sphere::bounding_box(Real t0, Real t1, AABB & output_box) const
@@ -48,8 +29,7 @@ bool Sphere::bounding_box(Real t0, Real t1, AABB & output_box) const
 double Sphere::pdf_value(const Point3 & o, const Vector3 & v) const
 {
     /* Probability that the v direction from o hits this sphere */
-    HitRecord rec;
-    if (!this->hit(Ray(o, v), 0.001, infinity, rec))
+    if (!sphere_occluded(center_, radius_, Ray(o, v), 0.001, infinity))
         return 0;
 
     auto cos_theta_max = sqrt(1 - radius_ * radius_ / (center_ - o).length_squared());
@@ -70,42 +50,23 @@ Vector3 Sphere::random(const Vector3 & o) const
 
 bool MovingSphere::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
 {
-    /* Center of sphere at time t */
-    Vector3 center_t = center(r.time_);
-
-    Vector3 oc = r.origin() - center_t;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius_ * radius_;
-    auto discriminant = half_b * half_b - a * c;
-
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
+    if (!MovingSphere::intersect(r, t_min, t_max, rec))
+        return false;
 
-        auto temp = (-half_b - root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t_ = temp;
-            rec.p_ = r.at(rec.t_);
-            Vector3 outward_normal = (rec.p_ - center_t) / radius_;
-            rec.SetFaceNormal(r, outward_normal);
-            GetSphereUV((rec.p_ - center_t) / radius_, rec.u_, rec.v_);
-            rec.mat_ = mat_;
-            return true;
-        }
+    finalize_hit(r, rec);
+    return true;
+}
 
-        temp = (-half_b + root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t_ = temp;
-            rec.p_ = r.at(rec.t_);
-            Vector3 outward_normal = (rec.p_ - center_t) / radius_;
-            rec.SetFaceNormal(r, outward_normal);
-            GetSphereUV((rec.p_ - center_t) / radius_, rec.u_, rec.v_);
-            rec.mat_ = mat_;
-            return true;
-        }
-    }
+void MovingSphere::finalize(const Ray & r, HitRecord & rec) const
+{
+    /* Center of sphere at time t */
+    Vector3 center_t = center(r.time_);
 
-    return false;
+    rec.p_ = r.at(rec.t_);
+    Vector3 outward_normal = (rec.p_ - center_t) / radius_;
+    rec.SetFaceNormal(r, outward_normal);
+    GetSphereUV(outward_normal, rec.u_, rec.v_);
+    rec.mat_ = mat_.get();
 }
 
 bool MovingSphere::bounding_box(Real t0, Real t1, AABB & output_box) const
@@ -120,11 +81,6 @@ bool MovingSphere::bounding_box(Real t0, Real t1, AABB & output_box) const
     return true;
 }
 
-Point3 MovingSphere::center(Real time) const
-{
-    return center0_ + ((time - time0_) / (time1_ - time0_))*(center1_ - center0_);
-}
-
 void GetSphereUV(const Vector3 & p, Real & u, Real & v)
 {
     auto phi = atan2(p.z(), p.x());
@@ -19,8 +19,14 @@ public:
     virtual bool hit(
         const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
 
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
 
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
     virtual double pdf_value(const Point3& o, const Vector3& v) const override;
 
     virtual Vector3 random(const Vector3& o) const override;
@@ -40,9 +46,15 @@ public:
     {};
 
     virtual bool hit(const Ray& r, Real tmin, Real tmax, HitRecord& rec) const override;
+
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
     
     virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
 
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
     Point3 center(Real time) const;
 
 public:
@@ -52,4 +64,70 @@ public:
     shared_ptr<Material> mat_;
 };
 
+/* Intersection tests are inline, so that typed BVH leaves can call them without a virtual call */
+
+/* The nearest of the two roots of the ray and sphere intersection within (t_min, t_max), in t */
+inline bool sphere_root(const Point3& center, Real radius, const Ray& r, Real t_min, Real t_max, Real& t)
+{
+    Vector3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+    auto discriminant = half_b * half_b - a * c;
+
+    if (discriminant <= 0)
+        return false;
+
+    auto root = sqrt(discriminant);
+    t = (-half_b - root) / a;
+    if (t < t_max && t > t_min)
+        return true;
+    t = (-half_b + root) / a;
+    return t < t_max && t > t_min;
+}
+
+/* Check if any of the two roots of the ray and sphere intersection is within [t_min, t_max] */
+inline bool sphere_occluded(const Point3& center, Real radius, const Ray& r, Real t_min, Real t_max)
+{
+    Real t;
+    return sphere_root(center, radius, r, t_min, t_max, t);
+}
+
+inline bool Sphere::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    Real t;
+    if (!sphere_root(center_, radius_, r, t_min, t_max, t))
+        return false;
+
+    rec.t_ = t;
+    rec.object_ = this;
+    return true;
+}
+
+inline bool Sphere::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    return sphere_occluded(center_, radius_, r, t_min, t_max);
+}
+
+inline Point3 MovingSphere::center(Real time) const
+{
+    return center0_ + ((time - time0_) / (time1_ - time0_))*(center1_ - center0_);
+}
+
+inline bool MovingSphere::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    Real t;
+    if (!sphere_root(center(r.time_), radius_, r, t_min, t_max, t))
+        return false;
+
+    rec.t_ = t;
+    rec.object_ = this;
+    return true;
+}
+
+inline bool MovingSphere::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    return sphere_occluded(center(r.time_), radius_, r, t_min, t_max);
+}
+
 #endif
@@ -0,0 +1,200 @@
+#include "SphereBatch.hpp"
+#include "Sphere.hpp"
+#include "math/Simd.hpp"
+
+#include <algorithm>
+#include <type_traits>
+
+void SphereBatch::add(const Point3 & center0, const Point3 & center1, Real time0, Real time1, Real radius, shared_ptr<Material> mat)
+{
+    /* Drop the padding of an earlier build */
+    size_t n = material_.size();
+    for (int a = 0; a < 3; a++) {
+        center_[a].resize(n);
+        velocity_[a].resize(n);
+    }
+    radius_.resize(n);
+
+    Vector3 velocity = time1 > time0 ? (center1 - center0) / (time1 - time0) : Vector3(0, 0, 0);
+    Point3 center = center0 - time0 * velocity;
+    for (int a = 0; a < 3; a++) {
+        center_[a].push_back(center[a]);
+        velocity_[a].push_back(velocity[a]);
+    }
+    radius_.push_back(radius);
+    moving_ |= velocity.length_squared() > 0;
+
+    auto inserted = material_index_.emplace(mat.get(), static_cast<uint32_t>(materials_.size()));
+    if (inserted.second)
+        materials_.push_back(mat);
+    material_.push_back(inserted.first->second);
+}
+
+void SphereBatch::build(Real time0, Real time1, const BVHBuildOptions & options)
+{
+    size_t n = material_.size();
+    nodes_.clear();
+    if (n == 0)
+        return;
+
+    std::vector<BVHPrimitiveInfo> prims(n);
+    for (size_t i = 0; i < n; i++) {
+        Point3 c0(center_[0][i] + time0 * velocity_[0][i], center_[1][i] + time0 * velocity_[1][i], center_[2][i] + time0 * velocity_[2][i]);
+        Point3 c1(center_[0][i] + time1 * velocity_[0][i], center_[1][i] + time1 * velocity_[1][i], center_[2][i] + time1 * velocity_[2][i]);
+        Vector3 extent(radius_[i], radius_[i], radius_[i]);
+        prims[i].index_ = i;
+        prims[i].bounds_ = AABB(c0 - extent, c0 + extent);
+        prims[i].bounds_.expand(AABB(c1 - extent, c1 + extent));
+        prims[i].centroid_ = prims[i].bounds_.centroid();
+    }
+
+    /* A SIMD group costs about as much as a single sphere, so leaves can hold a few groups */
+    BVHBuildOptions build_options = LinearBVH::build_options(options);
+    build_options.max_leaf_size_ = std::max<size_t>(build_options.max_leaf_size_, 2 * simd_width);
+    build_options.intersection_cost_ = options.intersection_cost_ / simd_width;
+
+    auto root = bvh_build(prims, build_options);
+    linear_bvh_flatten(*root, nodes_);
+
+    /* Reorder into leaf order, spheres referenced by more than one leaf are copied */
+    auto reorder = [&](auto& values, auto padding) {
+        std::remove_reference_t<decltype(values)> ordered;
+        ordered.reserve(prims.size() + simd_width);
+        for (const auto& prim : prims)
+            ordered.push_back(values[prim.index_]);
+        values.swap(ordered);
+        values.resize(prims.size() + padding, 0);
+    };
+    for (int a = 0; a < 3; a++) {
+        reorder(center_[a], simd_width);
+        reorder(velocity_[a], simd_width);
+    }
+    reorder(radius_, simd_width);
+    reorder(material_, 0);
+}
+
+/*
+    Intersect the ray with the spheres [first, last), a SIMD group at a time. Returns the index of the closest
+    sphere hit within (t_min, t_closest), and shrinks t_closest to its distance, or returns -1. With any_hit,
+    returns the first sphere found
+*/
+template<bool any_hit>
+static inline long spheres_hit(const SphereBatch& batch, const Ray& r, size_t first, size_t last, Real t_min, Real& t_closest)
+{
+    const Real* cx = batch.center_[0].data();
+    const Real* cy = batch.center_[1].data();
+    const Real* cz = batch.center_[2].data();
+    const Real* radius = batch.radius_.data();
+    Real time = r.Time();
+    Real ox = r.origin_.x(), oy = r.origin_.y(), oz = r.origin_.z();
+    Real dx = r.direction_.x(), dy = r.direction_.y(), dz = r.direction_.z();
+    Real a = r.direction_.length_squared();
+    long closest = -1;
+
+    SimdReal va(a), lo(t_min), zero(0.0), inf(infinity);
+
+    for (size_t i = first; i < last; i += simd_width) {
+        SimdReal ocx = SimdReal(ox) - SimdReal::load(cx + i);
+        SimdReal ocy = SimdReal(oy) - SimdReal::load(cy + i);
+        SimdReal ocz = SimdReal(oz) - SimdReal::load(cz + i);
+        if (batch.moving_) {
+            SimdReal vt(time);
+            ocx = ocx - SimdReal::load(batch.velocity_[0].data() + i) * vt;
+            ocy = ocy - SimdReal::load(batch.velocity_[1].data() + i) * vt;
+            ocz = ocz - SimdReal::load(batch.velocity_[2].data() + i) * vt;
+        }
+
+        /* Same steps as Sphere::hit, per lane */
+        SimdReal rad = SimdReal::load(radius + i);
+        SimdReal half_b = ocx * SimdReal(dx) + ocy * SimdReal(dy) + ocz * SimdReal(dz);
+        SimdReal c = ocx * ocx + ocy * ocy + ocz * ocz - rad * rad;
+        SimdReal discriminant = half_b * half_b - va * c;
+        SimdMask valid = discriminant > zero;
+        SimdReal root = sqrt(max(discriminant, zero));
+        SimdReal t_near = (zero - half_b - root) / va;
+        SimdReal t_far = (zero - half_b + root) / va;
+
+        SimdReal hi(t_closest);
+        SimdMask near_in = valid & (t_near > lo) & (t_near < hi);
+        SimdMask far_in = valid & (t_far > lo) & (t_far < hi);
+
+        /* Lanes past the range belong to the next leaf, or to the padding */
+        int lanes = simd_lanes_below(static_cast<int>(last - i));
+        if (((near_in | far_in).bits() & lanes) == 0)
+            continue;
+
+        Real t[simd_width];
+        select(near_in, t_near, select(far_in, t_far, inf)).store(t);
+        for (int lane = 0; lane < simd_width; lane++) {
+            if ((lanes >> lane & 1) && t[lane] < t_closest) {
+                t_closest = t[lane];
+                closest = static_cast<long>(i + lane);
+                if (any_hit)
+                    return closest;
+            }
+        }
+    }
+
+    return closest;
+}
+
+bool SphereBatch::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    if (!SphereBatch::intersect(r, t_min, t_max, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool SphereBatch::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    long closest = -1;
+    Real t_hit = t_max;
+    bool found = linear_bvh_traverse(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        long sphere = spheres_hit<false>(*this, r, offset, offset + count, t_min, t_closest);
+        if (sphere < 0)
+            return false;
+        closest = sphere;
+        t_hit = t_closest;
+        return true;
+    });
+
+    if (!found)
+        return false;
+
+    rec.t_ = t_hit;
+    rec.primitive_ = static_cast<uint32_t>(closest);
+    rec.object_ = this;
+    return true;
+}
+
+void SphereBatch::finalize(const Ray & r, HitRecord & rec) const
+{
+    uint32_t closest = rec.primitive_;
+    Real time = r.Time();
+    Point3 center(center_[0][closest] + time * velocity_[0][closest], center_[1][closest] + time * velocity_[1][closest], center_[2][closest] + time * velocity_[2][closest]);
+    Real radius = radius_[closest];
+
+    rec.p_ = r.at(rec.t_);
+    Vector3 outward_normal = (rec.p_ - center) / radius;
+    rec.SetFaceNormal(r, outward_normal);
+    GetSphereUV(outward_normal, rec.u_, rec.v_);
+    rec.mat_ = materials_[material_[closest]].get();
+}
+
+bool SphereBatch::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        return spheres_hit<true>(*this, r, offset, offset + count, t_min, t_closest) >= 0;
+    });
+}
+
+bool SphereBatch::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
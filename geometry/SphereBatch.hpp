@@ -0,0 +1,62 @@
+#ifndef __SphereBatch_hpp__
+#define __SphereBatch_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Many spheres as a single object, stored as arrays per component. The batch keeps its own BVH, whose leaves
+    test their spheres a SIMD group at a time: 4 with AVX, 2 with SSE2. The hit record is only filled for the
+    closest sphere. Spheres can move linearly, like MovingSphere
+*/
+class SphereBatch : public Hittable {
+public:
+    SphereBatch() {};
+
+    void add(const Point3& center, Real radius, shared_ptr<Material> mat) {
+        add(center, center, 0, 1, radius, mat);
+    }
+
+    /* A sphere moving from center0 at time0 to center1 at time1 */
+    void add(const Point3& center0, const Point3& center1, Real time0, Real time1, Real radius, shared_ptr<Material> mat);
+
+    /* Build the BVH over the spheres added so far, with bounds over [time0, time1]. Needed before any hit */
+    void build(Real time0, Real time1, const BVHBuildOptions& options = BVHBuildOptions());
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
+    size_t size() const {
+        return material_.size();
+    }
+
+public:
+    /*
+        Center at time 0, and velocity. Ordered so that every leaf references a contiguous range after the build,
+        which also pads these arrays with a SIMD group of empty spheres, so the last group can be loaded whole
+    */
+    std::vector<Real> center_[3];
+    std::vector<Real> velocity_[3];
+    std::vector<Real> radius_;
+    /* Index into materials_ */
+    std::vector<uint32_t> material_;
+    std::vector<shared_ptr<Material>> materials_;
+    std::vector<LinearBVHNode> nodes_;
+    /* False if no sphere moves, which skips the motion in the intersection */
+    bool moving_ = false;
+
+private:
+    std::unordered_map<const Material*, uint32_t> material_index_;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "TriangleMesh.hpp"
+
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+/* Per ray data of the watertight test. The ray is sheared so that it points along +z from the origin */
+struct WatertightRay {
+    Point3 origin_;
+    int kx_, ky_, kz_;
+    Real sx_, sy_, sz_;
+};
+
+static WatertightRay watertight_ray(const Ray& r)
+{
+    WatertightRay w;
+    const Vector3& d = r.direction_;
+    w.origin_ = r.origin_;
+
+    /* The largest component becomes z, swapping x and y keeps the winding when it is negative */
+    w.kz_ = std::fabs(d.x()) > std::fabs(d.y()) ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2) : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+    w.kx_ = (w.kz_ + 1) % 3;
+    w.ky_ = (w.kx_ + 1) % 3;
+    if (d[w.kz_] < 0)
+        std::swap(w.kx_, w.ky_);
+
+    w.sx_ = d[w.kx_] / d[w.kz_];
+    w.sy_ = d[w.ky_] / d[w.kz_];
+    w.sz_ = 1 / d[w.kz_];
+    return w;
+}
+
+/*
+    Intersect the triangle p0 p1 p2. On a hit within (t_min, t_max), stores the distance, and the barycentric
+    coordinates of p1 and p2
+*/
+static inline bool triangle_hit(const WatertightRay& w, const Point3& p0, const Point3& p1, const Point3& p2, Real t_min, Real t_max, Real& t, Real& b1, Real& b2)
+{
+    Vector3 a = p0 - w.origin_;
+    Vector3 b = p1 - w.origin_;
+    Vector3 c = p2 - w.origin_;
+
+    Real ax = a[w.kx_] - w.sx_ * a[w.kz_];
+    Real ay = a[w.ky_] - w.sy_ * a[w.kz_];
+    Real bx = b[w.kx_] - w.sx_ * b[w.kz_];
+    Real by = b[w.ky_] - w.sy_ * b[w.kz_];
+    Real cx = c[w.kx_] - w.sx_ * c[w.kz_];
+    Real cy = c[w.ky_] - w.sy_ * c[w.kz_];
+
+    /* Scaled barycentric coordinates, as the edge functions of the sheared triangle */
+    Real u = cx * by - cy * bx;
+    Real v = ax * cy - ay * cx;
+    Real e = bx * ay - by * ax;
+
+    /* A ray exactly through an edge is decided in higher precision, so the triangles sharing it agree */
+    if (u == 0 || v == 0 || e == 0) {
+        u = static_cast<Real>(static_cast<long double>(cx) * by - static_cast<long double>(cy) * bx);
+        v = static_cast<Real>(static_cast<long double>(ax) * cy - static_cast<long double>(ay) * cx);
+        e = static_cast<Real>(static_cast<long double>(bx) * ay - static_cast<long double>(by) * ax);
+    }
+
+    if ((u < 0 || v < 0 || e < 0) && (u > 0 || v > 0 || e > 0))
+        return false;
+
+    Real det = u + v + e;
+    if (det == 0)
+        return false;
+
+    Real az = w.sz_ * a[w.kz_];
+    Real bz = w.sz_ * b[w.kz_];
+    Real cz = w.sz_ * c[w.kz_];
+    Real t_hit = (u * az + v * bz + e * cz) / det;
+    if (!(t_hit > t_min && t_hit < t_max))
+        return false;
+
+    t = t_hit;
+    b1 = v / det;
+    b2 = e / det;
+    return true;
+}
+
+TriangleMesh::TriangleMesh(std::vector<Point3> positions, std::vector<uint32_t> indices, shared_ptr<Material> mat,
+    std::vector<Vector3> normals, std::vector<Real> uvs, const BVHBuildOptions& options)
+    : positions_(std::move(positions)), normals_(std::move(normals)), uvs_(std::move(uvs)), mat_(mat)
+{
+    if (!normals_.empty() && normals_.size() != positions_.size()) {
+        std::cerr << "TriangleMesh: normal count doesn't match the vertex count, normals ignored.\n";
+        normals_.clear();
+    }
+    if (!uvs_.empty() && uvs_.size() != 2 * positions_.size()) {
+        std::cerr << "TriangleMesh: uv count doesn't match the vertex count, uvs ignored.\n";
+        uvs_.clear();
+    }
+    if (indices.size() % 3 != 0)
+        std::cerr << "TriangleMesh: index count isn't a multiple of 3.\n";
+
+    /* Triangles with out of range indices are dropped */
+    std::vector<BVHPrimitiveInfo> prims;
+    prims.reserve(indices.size() / 3);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        if (indices[i] >= positions_.size() || indices[i + 1] >= positions_.size() || indices[i + 2] >= positions_.size()) {
+            std::cerr << "TriangleMesh: vertex index out of range in triangle " << i / 3 << ".\n";
+            continue;
+        }
+
+        BVHPrimitiveInfo info;
+        info.index_ = i / 3;
+        info.bounds_ = AABB::empty();
+        for (int k = 0; k < 3; k++)
+            info.bounds_.expand(positions_[indices[i + k]]);
+        info.centroid_ = info.bounds_.centroid();
+        prims.push_back(info);
+    }
+
+    if (prims.empty())
+        return;
+
+    auto root = bvh_build(prims, LinearBVH::build_options(options));
+    linear_bvh_flatten(*root, nodes_);
+
+    /* Triangles in leaf order. With spatial splits a triangle can be stored more than once */
+    indices_.reserve(3 * prims.size());
+    for (const auto& prim : prims) {
+        for (int k = 0; k < 3; k++)
+            indices_.push_back(indices[3 * prim.index_ + k]);
+    }
+}
+
+TriangleMesh::TriangleMesh(std::vector<Point3> positions, std::vector<uint32_t> indices, std::vector<LinearBVHNode> nodes,
+    shared_ptr<Material> mat, std::vector<Vector3> normals, std::vector<Real> uvs)
+    : positions_(std::move(positions)), normals_(std::move(normals)), uvs_(std::move(uvs)), indices_(std::move(indices)), mat_(mat), nodes_(std::move(nodes))
+{
+}
+
+bool TriangleMesh::hit(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    if (!TriangleMesh::intersect(r, t_min, t_max, rec))
+        return false;
+
+    finalize_hit(r, rec);
+    return true;
+}
+
+bool TriangleMesh::intersect(const Ray & r, Real t_min, Real t_max, HitRecord & rec) const
+{
+    WatertightRay w = watertight_ray(r);
+    uint32_t closest = 0;
+    Real t_hit = 0, b1 = 0, b2 = 0;
+
+    /* Only the distance and the barycentric coordinates are kept, finalize fills the record */
+    bool found = linear_bvh_traverse(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        bool hit_anything = false;
+        for (uint32_t tri = offset; tri < offset + count; tri++) {
+            const uint32_t* v = &indices_[3 * tri];
+            if (triangle_hit(w, positions_[v[0]], positions_[v[1]], positions_[v[2]], t_min, t_closest, t_hit, b1, b2)) {
+                t_closest = t_hit;
+                closest = tri;
+                hit_anything = true;
+            }
+        }
+        return hit_anything;
+    });
+
+    if (!found)
+        return false;
+
+    rec.t_ = t_hit;
+    rec.u_ = b1;
+    rec.v_ = b2;
+    rec.primitive_ = closest;
+    rec.object_ = this;
+    return true;
+}
+
+void TriangleMesh::finalize(const Ray & r, HitRecord & rec) const
+{
+    const uint32_t* v = &indices_[3 * rec.primitive_];
+    const Point3& p0 = positions_[v[0]];
+    const Point3& p1 = positions_[v[1]];
+    const Point3& p2 = positions_[v[2]];
+    Real b1 = rec.u_, b2 = rec.v_;
+    Real b0 = 1 - b1 - b2;
+
+    /* The barycentric point lies on the triangle, r.at(t) can be off by the rounding of t */
+    rec.p_ = b0 * p0 + b1 * p1 + b2 * p2;
+
+    Vector3 geometric_normal = cross(p1 - p0, p2 - p0);
+    if (geometric_normal.length_squared() == 0)
+        geometric_normal = -r.direction();
+    rec.SetFaceNormal(r, unit_vector(geometric_normal));
+
+    /* Shading normals are flipped to the side of the geometric normal the ray came from */
+    if (!normals_.empty()) {
+        Vector3 n = b0 * normals_[v[0]] + b1 * normals_[v[1]] + b2 * normals_[v[2]];
+        if (n.length_squared() > 0) {
+            n = unit_vector(n);
+            rec.normal_ = dot(n, rec.normal_) < 0 ? -n : n;
+        }
+    }
+
+    if (!uvs_.empty()) {
+        rec.u_ = b0 * uvs_[2 * v[0]] + b1 * uvs_[2 * v[1]] + b2 * uvs_[2 * v[2]];
+        rec.v_ = b0 * uvs_[2 * v[0] + 1] + b1 * uvs_[2 * v[1] + 1] + b2 * uvs_[2 * v[2] + 1];
+    }
+
+    rec.mat_ = mat_.get();
+}
+
+bool TriangleMesh::occluded(const Ray & r, Real t_min, Real t_max) const
+{
+    WatertightRay w = watertight_ray(r);
+    return linear_bvh_traverse<true>(nodes_.data(), nodes_.size(), r, t_min, t_max, [&](uint32_t offset, uint32_t count, Real& t_closest) {
+        Real t, b1, b2;
+        for (uint32_t tri = offset; tri < offset + count; tri++) {
+            const uint32_t* v = &indices_[3 * tri];
+            if (triangle_hit(w, positions_[v[0]], positions_[v[1]], positions_[v[2]], t_min, t_closest, t, b1, b2))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool TriangleMesh::bounding_box(Real t0, Real t1, AABB & output_box) const
+{
+    if (nodes_.empty())
+        return false;
+
+    output_box = linear_bvh_bounds(nodes_[0]);
+    return true;
+}
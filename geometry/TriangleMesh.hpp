@@ -0,0 +1,53 @@
+#ifndef __TriangleMesh_hpp__
+#define __TriangleMesh_hpp__
+
+#include "Common.hpp"
+#include "Hittable.hpp"
+#include "Material.hpp"
+#include "BVH.hpp"
+#include "LinearBVH.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/*
+    An indexed triangle mesh with a single material. Vertex attributes are shared between the triangles,
+    and the mesh keeps its own BVH over the triangles, so no object is allocated per triangle.
+    Triangles are tested with the watertight algorithm of Woop et al., so rays through shared edges
+    and vertices can't slip between the triangles
+*/
+class TriangleMesh : public Hittable {
+public:
+    /*
+        indices holds three vertex indices per triangle. normals and uvs are optional per vertex attributes,
+        with two values per vertex for uvs. Without normals the geometric normal is used, without uvs the
+        barycentric coordinates
+    */
+    TriangleMesh(std::vector<Point3> positions, std::vector<uint32_t> indices, shared_ptr<Material> mat,
+        std::vector<Vector3> normals = {}, std::vector<Real> uvs = {}, const BVHBuildOptions& options = BVHBuildOptions());
+
+    /* A mesh whose BVH is already built, indices are in the leaf order of nodes. Nothing is checked */
+    TriangleMesh(std::vector<Point3> positions, std::vector<uint32_t> indices, std::vector<LinearBVHNode> nodes,
+        shared_ptr<Material> mat, std::vector<Vector3> normals = {}, std::vector<Real> uvs = {});
+
+    virtual bool hit(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual bool intersect(const Ray& r, Real t_min, Real t_max, HitRecord& rec) const override;
+    virtual void finalize(const Ray& r, HitRecord& rec) const override;
+    virtual bool bounding_box(Real t0, Real t1, AABB& output_box) const override;
+    virtual bool occluded(const Ray& r, Real t_min, Real t_max) const override;
+
+    size_t triangle_count() const {
+        return indices_.size() / 3;
+    }
+
+public:
+    std::vector<Point3> positions_;
+    std::vector<Vector3> normals_;
+    std::vector<Real> uvs_;
+    /* Three vertex indices per triangle, ordered so that every leaf of the BVH references a contiguous range */
+    std::vector<uint32_t> indices_;
+    shared_ptr<Material> mat_;
+    std::vector<LinearBVHNode> nodes_;
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include <vector>
 #include <limits>
 #include <atomic>
+#include <chrono>
+#include <string>
 #include <omp.h>
 
 #include "Common.hpp"
@@ -18,7 +20,21 @@
 #include "geometry/ConstantMedium.hpp"
 #include "Camera.hpp"
 #include "Material.hpp"
+#include "geometry/Instance.hpp"
+#include "geometry/MeshLoader.hpp"
+#include "geometry/ChunkedMesh.hpp"
+#include "geometry/SphereBatch.hpp"
+#include "geometry/QuadBatch.hpp"
+#include "geometry/SDF.hpp"
 #include "BVH.hpp"
+#include "LinearBVH.hpp"
+#include "WideBVH.hpp"
+#include "QuantizedBVH.hpp"
+#include "MotionBVH.hpp"
+#include "CachedBVH.hpp"
+#include "BVHStats.hpp"
+#include "InstanceBVH.hpp"
+#include "Scene.hpp"
 
 /* Write an image to the disk */
 void CreateImage(std::shared_ptr<Vector3> data, const std::string& file_name, int width, int height, int samples_per_pixel) {
@@ -39,11 +55,12 @@ void CreateImage(std::shared_ptr<Vector3> data, const std::string& file_name, in
     std::cout << "DONE" << std::endl;
 }
 
-Color ray_color(const Ray& r, const Color& background, const Hittable& world, shared_ptr<Hittable> lights, int depth) {
+Color ray_color(const Ray& r, const Color& background, const Hittable& world, const Hittable* lights, int depth) {
     if (depth <= 0)
         return Color(0, 0, 0);
 
     HitRecord rec;
+    BVH_STATS_ADD(rays_, 1);
     if (!world.hit(r, 0.001, infinity, rec)) {
         return background;
     }
@@ -53,21 +70,68 @@ Color ray_color(const Ray& r, const Color& background, const Hittable& world, sh
     if (!rec.mat_->scatter(r, rec, srec))
         return emitted;
 
-    if (srec.is_specular_) {
+    /* Without a pdf, the material picked the direction itself, like the isotropic phase function */
+    if (srec.is_specular_ || !srec.pdf_) {
         return srec.attenuation_
             * ray_color(srec.specular_ray_, background, world, lights, depth - 1);
     }
 
-    auto light_ptr = make_shared<HittablePDF>(lights, rec.p_);
-    MixturePDF p(light_ptr, srec.pdf_);
-
-    Ray scattered = Ray(rec.p_, p.generate(), r.Time());
-    auto pdf_val = p.value(scattered.direction());
+    /* On the stack, the bounces allocate nothing. Scenes without lights only sample the material */
+    Ray scattered;
+    Real pdf_val;
+    if (lights) {
+        HittablePDF light_pdf(*lights, rec.p_);
+        MixturePDF p(light_pdf, *srec.pdf_);
+        scattered = Ray(rec.p_, p.generate(), r.Time());
+        pdf_val = p.value(scattered.direction());
+    } else {
+        scattered = Ray(rec.p_, srec.pdf_->generate(), r.Time());
+        pdf_val = srec.pdf_->value(scattered.direction());
+    }
 
     return emitted + srec.attenuation_ 
             * rec.mat_->scattering_pdf(r, rec, scattered) * ray_color(scattered, background, world, lights, depth - 1) / pdf_val;
 }
 
+/* Print the tree statistics of the scene acceleration structure */
+void print_bvh_stats(const Hittable& scene, const BVHBuildOptions& options) {
+    BVHTreeStats stats;
+    if (auto cached = dynamic_cast<const CachedBVH*>(&scene))
+        stats = bvh_tree_stats(cached->nodes(), cached->node_count(), options.traversal_cost_, options.intersection_cost_);
+    else if (auto wide = dynamic_cast<const WideBVH*>(&scene))
+        stats = bvh_tree_stats(*wide, options.traversal_cost_, options.intersection_cost_);
+    else if (auto quantized = dynamic_cast<const QuantizedBVH8*>(&scene))
+        stats = bvh_tree_stats(*quantized, options.traversal_cost_, options.intersection_cost_);
+    else if (auto motion = dynamic_cast<const MotionBVH*>(&scene))
+        stats = bvh_tree_stats(*motion, options.traversal_cost_, options.intersection_cost_);
+    else if (auto compiled = dynamic_cast<const CompiledScene*>(&scene))
+        /* Leaves hold ranges of primitives of one type, counted as primitives */
+        stats = bvh_tree_stats(compiled->accel_.nodes_.data(), compiled->accel_.nodes_.size(), options.traversal_cost_, options.intersection_cost_);
+    else if (auto node = dynamic_cast<const BVHNode*>(&scene))
+        stats = bvh_tree_stats(*node, options.traversal_cost_, options.intersection_cost_);
+    else
+        return;
+
+    stats.print(std::cout);
+}
+
+/* Milliseconds passed since start */
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Build a BVH over the objects, and report its cost and build time */
+shared_ptr<BVHNode> create_bvh(const HittableList& objects, Real time0, Real time1, const BVHBuildOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    auto bvh = make_shared<BVHNode>(objects, time0, time1, options);
+    auto build_time = elapsed_ms(start);
+
+    std::cout << "BVH over " << objects.objects_.size() << " objects, SAH cost: "
+        << bvh->sah_cost(options.traversal_cost_, options.intersection_cost_)
+        << ", built in " << build_time << " ms" << std::endl;
+    return bvh;
+}
+
 /* Create scenes */
 HittableList two_spheres() {
     HittableList objects;
@@ -86,6 +150,9 @@ HittableList random_scene() {
     auto checker_texture = make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
     world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Lambertian>(checker_texture)));
 
+    /* All the spheres but the ground, intersected a SIMD group at a time */
+    auto spheres = make_shared<SphereBatch>();
+
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
             auto choose_mat = random_double();
@@ -99,33 +166,35 @@ HittableList random_scene() {
                     auto albedo = Color::random() * Color::random();
                     sphere_material = make_shared<Lambertian>(albedo);
                     auto center2 = center + Vector3(0, random_double(0, .5), 0);
-                    world.add(make_shared<MovingSphere>(
-                        center, center2, 0.0, 1.0, 0.2, sphere_material));
+                    spheres->add(center, center2, 0.0, 1.0, 0.2, sphere_material);
                 }
                 else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = Color::random(0.5, 1.0);
                     auto fuzz = random_double(0, 0.5);
                     sphere_material = make_shared<Metal>(albedo, fuzz);
-                    world.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                    spheres->add(center, 0.2, sphere_material);
                 }
                 else {
                     // glass
                     sphere_material = make_shared<Dielectric>(1.5);
-                    world.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                    spheres->add(center, 0.2, sphere_material);
                 }
             }
         }
     }
 
     auto material1 = make_shared<Dielectric>(1.5);
-    world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+    spheres->add(Point3(0, 1, 0), 1.0, material1);
 
     auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+    spheres->add(Point3(-4, 1, 0), 1.0, material2);
 
     auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+    spheres->add(Point3(4, 1, 0), 1.0, material3);
+
+    spheres->build(0.0, 1.0);
+    world.add(spheres);
 
     return world;
 }
@@ -172,17 +241,19 @@ HittableList cornell_box(shared_ptr<Hittable>& lights) {
     auto green = make_shared<Lambertian>(Color(.12, .45, .15));
     auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
 
-    objects.add(make_shared<YZRect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<YZRect>(0, 555, 0, 555, 0, red));
-    
+    /* The walls and the light, facing down, as one batch. The light is still sampled on its own */
+    auto walls = make_shared<QuadBatch>();
+    walls->add_yz_rect(0, 555, 0, 555, 555, green);
+    walls->add_yz_rect(0, 555, 0, 555, 0, red);
+    walls->add_xz_rect(213, 343, 227, 332, 554, light, true);
+    walls->add_xz_rect(0, 555, 0, 555, 0, white);
+    walls->add_xz_rect(0, 555, 0, 555, 555, white);
+    walls->add_xy_rect(0, 555, 0, 555, 555, white);
+    walls->build();
+    objects.add(walls);
+
     HittableList samplers;
-    
-    shared_ptr<Hittable> light_rec = make_shared<XZRect>(213, 343, 227, 332, 554, light);
-    samplers.add(light_rec);
-    objects.add(make_shared<FlipFace>(light_rec));
-    objects.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
+    samplers.add(make_shared<XZRect>(213, 343, 227, 332, 554, light));
 
     shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
     box1 = make_shared<RotateY>(box1, 15);
@@ -198,6 +269,75 @@ HittableList cornell_box(shared_ptr<Hittable>& lights) {
     return objects;
 }
 
+/*
+    The mesh at path, paged in from a chunked copy of it so that at most memory_budget bytes of it are loaded.
+    The copy is written to path.chunks on the first run, and has to be deleted when the mesh changes
+*/
+shared_ptr<ChunkedMesh> load_chunked_mesh(const std::string& path, shared_ptr<Material> mat, size_t memory_budget, const BVHBuildOptions& bvh_options) {
+    std::string chunks_path = path + ".chunks";
+    if (!std::ifstream(chunks_path)) {
+        auto mesh = load_mesh(path, mat, bvh_options);
+        if (!mesh)
+            return nullptr;
+        if (!ChunkedMesh::write(chunks_path, mesh->positions_, mesh->indices_, mesh->normals_, mesh->uvs_, 4096, bvh_options)) {
+            std::cerr << "Could not write the chunked mesh " << chunks_path << std::endl;
+            return nullptr;
+        }
+        std::cout << "Chunked mesh written to " << chunks_path << std::endl;
+    }
+
+    auto chunked = make_shared<ChunkedMesh>(chunks_path, mat, memory_budget);
+    if (chunked->cluster_count() == 0)
+        return nullptr;
+    return chunked;
+}
+
+/* The cornell box with the mesh at path in it, scaled to fit. With a chunk budget, the mesh is paged in from a chunked copy */
+HittableList cornell_mesh(shared_ptr<Hittable>& lights, const std::string& path, const BVHBuildOptions& bvh_options, size_t chunk_budget = 0) {
+    HittableList objects;
+
+    auto red = make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
+
+    objects.add(make_shared<YZRect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<YZRect>(0, 555, 0, 555, 0, red));
+    shared_ptr<Hittable> light_rec = make_shared<XZRect>(213, 343, 227, 332, 554, light);
+    objects.add(make_shared<FlipFace>(light_rec));
+    objects.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
+    lights = light_rec;
+
+    auto start = std::chrono::steady_clock::now();
+    shared_ptr<Hittable> mesh;
+    if (chunk_budget == 0) {
+        auto loaded = load_mesh(path, white, bvh_options);
+        if (loaded)
+            std::cout << "Mesh of " << loaded->triangle_count() << " triangles, loaded in " << elapsed_ms(start) << " ms" << std::endl;
+        mesh = loaded;
+    } else {
+        auto chunked = load_chunked_mesh(path, white, chunk_budget, bvh_options);
+        if (chunked)
+            std::cout << "Mesh of " << chunked->triangle_count() << " triangles in " << chunked->cluster_count() << " clusters, opened in "
+                << elapsed_ms(start) << " ms" << std::endl;
+        mesh = chunked;
+    }
+    AABB bounds;
+    if (!mesh || !mesh->bounding_box(0, 0, bounds))
+        return objects;
+
+    /* Largest extent to 400, standing on the floor in the middle of the box */
+    auto extent = bounds.max() - bounds.min();
+    Real scale = 400 / std::max(extent.x(), std::max(extent.y(), extent.z()));
+    auto base = Point3(0.5 * (bounds.min().x() + bounds.max().x()), bounds.min().y(), 0.5 * (bounds.min().z() + bounds.max().z()));
+    objects.add(make_shared<Instance>(mesh,
+        Transform::translate(Vector3(278, 0, 278)) * Transform::scale(Vector3(scale, scale, scale)) * Transform::translate(-base)));
+
+    return objects;
+}
+
 HittableList cornell_smoke() {
     HittableList objects;
 
@@ -229,7 +369,7 @@ HittableList cornell_smoke() {
     return objects;
 }
 
-HittableList final_scene() {
+HittableList final_scene(const BVHBuildOptions& bvh_options) {
     HittableList boxes1;
     auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
 
@@ -250,7 +390,7 @@ HittableList final_scene() {
 
     HittableList objects;
 
-    objects.add(make_shared<BVHNode>(boxes1, 0, 1));
+    objects.add(create_bvh(boxes1, 0, 1, bvh_options));
 
     auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
     objects.add(make_shared<XZRect>(123, 423, 147, 412, 554, light));
@@ -276,24 +416,114 @@ HittableList final_scene() {
     auto pertext = make_shared<NoiseTexture>(0.1);
     objects.add(make_shared<Sphere>(Point3(220, 280, 300), 80, make_shared<Lambertian>(pertext)));
 
-    HittableList boxes2;
+    auto boxes2 = make_shared<SphereBatch>();
     auto white = make_shared<Lambertian>(Color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<Sphere>(Point3::random(0, 165), 10, white));
+        boxes2->add(Point3::random(0, 165), 10, white);
     }
+    boxes2->build(0.0, 1.0, bvh_options);
 
-    objects.add(make_shared<Translate>(
-        make_shared<RotateY>(
-            make_shared<BVHNode>(boxes2, 0.0, 1.0), 15),
-        Vector3(-100, 270, 395)
+    objects.add(make_shared<Instance>(
+        boxes2,
+        Transform::translate(Vector3(-100, 270, 395)) * Transform::rotate_y(15)
         )
     );
 
     return objects;
 }
 
-int main() {
+HittableList instanced_clusters(shared_ptr<Hittable>& lights, const BVHBuildOptions& bvh_options) {
+    HittableList objects;
+
+    auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+    objects.add(make_shared<XZRect>(-20000, 20000, -20000, 20000, 0, ground));
+
+    auto light = make_shared<DiffuseLight>(Color(1.5, 1.5, 1.5));
+    shared_ptr<Hittable> light_rec = make_shared<XZRect>(-20000, 20000, -20000, 20000, 3000, light);
+    objects.add(make_shared<FlipFace>(light_rec));
+    lights = light_rec;
+
+    /* A single cluster of spheres, shared by all the instances */
+    HittableList cluster;
+    auto white = make_shared<Lambertian>(Color(.73, .73, .73));
+    for (int j = 0; j < 1000; j++) {
+        cluster.add(make_shared<Sphere>(Point3::random(0, 165), 10, white));
+    }
+    auto blas = make_shared<WideBVH>(cluster, 0, 1, bvh_options);
+
+    const int clusters_per_side = 100;
+    std::vector<Instance> instances;
+    instances.reserve(clusters_per_side * clusters_per_side);
+    for (int i = 0; i < clusters_per_side; i++) {
+        for (int j = 0; j < clusters_per_side; j++) {
+            auto offset = Vector3(-12500 + i * 250, 10, -12500 + j * 250);
+            instances.emplace_back(blas, Transform::translate(offset) * Transform::rotate_y(random_double(0, 360)));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    objects.add(make_shared<InstanceBVH>(instances, bvh_options));
+    std::cout << "Instance BVH over " << instances.size() << " instances, built in " << elapsed_ms(start) << " ms" << std::endl;
+
+    return objects;
+}
+
+/* Shapes described by distance fields: a blended torus and sphere, a rounded box, and a row of bumpy spheres */
+HittableList sdf_shapes(shared_ptr<Hittable>& lights) {
+    HittableList objects;
+
+    auto ground = make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+    objects.add(make_shared<XZRect>(-1000, 1000, -1000, 1000, 0, ground));
+
+    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
+    shared_ptr<Hittable> light_rec = make_shared<XZRect>(-3, 3, -3, 3, 10, light);
+    objects.add(make_shared<FlipFace>(light_rec));
+    lights = light_rec;
+
+    auto torus = make_shared<SDFTorus>(1.2, 0.35);
+    auto core = make_shared<SDFSphere>(0.8);
+    auto blended = make_shared<SDFTranslate>(make_shared<SDFSmoothUnion>(torus, core, 0.5), Vector3(0, 1.2, 0));
+    objects.add(make_shared<SDFObject>(blended, make_shared<Metal>(Color(0.8, 0.85, 0.88), 0.05)));
+
+    auto hollow = make_shared<SDFSubtraction>(make_shared<SDFBox>(Vector3(0.7, 0.7, 0.7), 0.1), make_shared<SDFSphere>(0.95));
+    objects.add(make_shared<SDFObject>(make_shared<SDFTranslate>(hollow, Vector3(-3, 0.8, 0)), make_shared<Lambertian>(Color(.65, .05, .05))));
+
+    /* Infinite repetition, clipped to a row of five */
+    auto bumpy = make_shared<SDFDisplace>(make_shared<SDFSphere>(0.4), 0.04, 12);
+    auto row = make_shared<SDFRepeat>(bumpy, Vector3(1.2, 0, 0));
+    objects.add(make_shared<SDFObject>(make_shared<SDFTranslate>(row, Vector3(0, 0.45, 2.5)), make_shared<Lambertian>(Color(.73, .73, .73)), AABB(Point3(-3, 0, 2.0), Point3(3, 1, 3.0))));
+
+    return objects;
+}
+
+int main(int argc, char* argv[]) {
+
+    /*
+        With --inspect, only build the scene and report on its BVH, without rendering. Static scenes are
+        flattened into arrays of primitives under a single tree, instead of rendering the graph they are
+        written as. With --cached, their BVH is stored in a file instead, and mapped on the next runs
+        instead of being built. With --quantized, it has 8 bit child bounds, half the size of the float
+        nodes, for scenes that don't fit in the caches
+    */
+    enum class SceneStructure { Compiled, Cached, Quantized };
+    bool inspect = false;
+    SceneStructure structure = SceneStructure::Compiled;
+    for (int a = 1; a < argc; a++) {
+        std::string arg(argv[a]);
+        if (arg == "--inspect")
+            inspect = true;
+        else if (arg == "--compiled")
+            structure = SceneStructure::Compiled;
+        else if (arg == "--cached")
+            structure = SceneStructure::Cached;
+        else if (arg == "--quantized")
+            structure = SceneStructure::Quantized;
+        else {
+            std::cerr << "Unknown argument " << arg << ", expected --inspect, --compiled, --cached or --quantized" << std::endl;
+            return 1;
+        }
+    }
 
     /* Default image parameters */
     Real aspect_ratio = 16.0 / 9.0;
@@ -303,6 +533,7 @@ int main() {
     /* Computation parameters */
     const int max_depth = 50;
     const int threads = 5;
+    BVHBuildOptions bvh_options;
 
     /* Scene and camera parameters */
     HittableList world;
@@ -316,9 +547,15 @@ int main() {
     Vector3 vup(0, 1, 0);
     auto dist_to_focus = 10.0;
     Color background(0, 0, 0);
+    /*
+        Spatial splits in the top level tree, for the scenes with large primitives that overlap everything
+        else. The SBVH build runs on a single thread, so the other trees keep the parallel SAH build
+    */
+    bool spatial_splits = false;
 
     /* Create scenes, and set scene specific parameters */
-    switch (6) {
+    const int scene_id = 6;
+    switch (scene_id) {
     case 1:
         world = random_scene();
         lookfrom = Point3(13, 2, 3);
@@ -374,9 +611,53 @@ int main() {
         lookat = Point3(278, 278, 0);
         vfov = 40.0;
         break;
+    case 9:
+        world = instanced_clusters(lights, bvh_options);
+        aspect_ratio = 16.0 / 9.0;
+        image_width = 400;
+        samples_per_pixel = 100;
+        background = Color(0, 0, 0);
+        lookfrom = Point3(-13000, 1200, -13000);
+        lookat = Point3(-10000, 0, -10000);
+        vfov = 40.0;
+        spatial_splits = true;
+        break;
+    case 10:
+        world = cornell_mesh(lights, "model.ply", bvh_options);
+        aspect_ratio = 1.0;
+        image_width = 600;
+        samples_per_pixel = 200;
+        background = Color(0, 0, 0);
+        lookfrom = Point3(278, 278, -800);
+        lookat = Point3(278, 278, 0);
+        vfov = 40.0;
+        spatial_splits = true;
+        break;
+    case 11:
+        world = sdf_shapes(lights);
+        aspect_ratio = 16.0 / 9.0;
+        image_width = 400;
+        samples_per_pixel = 200;
+        background = Color(0.70, 0.80, 1.00);
+        lookfrom = Point3(0, 4, 10);
+        lookat = Point3(0, 0.8, 0);
+        vfov = 35.0;
+        break;
+    case 12:
+        /* The mesh of scene 10, with at most 64 MB of it in memory */
+        world = cornell_mesh(lights, "model.ply", bvh_options, 64 << 20);
+        aspect_ratio = 1.0;
+        image_width = 600;
+        samples_per_pixel = 200;
+        background = Color(0, 0, 0);
+        lookfrom = Point3(278, 278, -800);
+        lookat = Point3(278, 278, 0);
+        vfov = 40.0;
+        spatial_splits = true;
+        break;
     default:
     case 8:
-        world = final_scene();
+        world = final_scene(bvh_options);
         aspect_ratio = 1.0;
         image_width = 256;
         samples_per_pixel = 10000;
@@ -389,6 +670,37 @@ int main() {
         break;
     }
 
+    /* Acceleration structure over the top level objects of the scene */
+    BVHBuildOptions scene_bvh_options = bvh_options;
+    if (spatial_splits)
+        scene_bvh_options.split_method_ = BVHSplitMethod::SBVH;
+    auto build_start = std::chrono::steady_clock::now();
+    shared_ptr<Hittable> scene;
+    if (time_end > time_start) {
+        /* Bounds interpolated to the time of the ray, instead of covering the whole shutter interval */
+        scene = make_shared<MotionBVH>(world, time_start, time_end, scene_bvh_options);
+        std::cout << "Scene motion BVH over " << world.objects_.size() << " objects, built in " << elapsed_ms(build_start) << " ms" << std::endl;
+    } else if (structure == SceneStructure::Compiled) {
+        /* The scenes that pass no lights get the emitters compile can find, see CompiledScene::lights */
+        auto compiled = Scene(world, lights).compile(time_start, time_end, scene_bvh_options);
+        lights = compiled->lights();
+        std::cout << "Scene compiled to " << compiled->primitive_count() << " primitives and " << compiled->materials_.size()
+            << " materials in " << elapsed_ms(build_start) << " ms" << std::endl;
+        scene = compiled;
+    } else if (structure == SceneStructure::Cached) {
+        auto cached = make_shared<CachedBVH>(world, time_start, time_end, "scene_", scene_bvh_options);
+        std::cout << "Scene BVH over " << world.objects_.size() << " objects, " << (cached->loaded() ? "mapped from " : "built and written to ")
+            << cached->path() << " in " << elapsed_ms(build_start) << " ms" << std::endl;
+        scene = cached;
+    } else {
+        scene = make_shared<QuantizedBVH8>(world, time_start, time_end, scene_bvh_options);
+        std::cout << "Scene quantized " << BVH_WIDTH << "-wide BVH over " << world.objects_.size() << " objects, built in " << elapsed_ms(build_start) << " ms" << std::endl;
+    }
+    print_bvh_stats(*scene, scene_bvh_options);
+
+    if (inspect)
+        return 0;
+
     /* Create a camera */
     Camera camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, time_start, time_end);
 
@@ -399,23 +711,30 @@ int main() {
     std::atomic<int> lines_remaining = { (int)image_height };
 #pragma omp parallel for num_threads(threads) shared(image_data) schedule(dynamic, 2)
     for (int j = image_height - 1; j >= 0; --j) {
-        for (int i = 0; i < image_width; ++i) {
+        for (size_t i = 0; i < image_width; ++i) {
             Color pixel_color(0, 0, 0);
             for (int s = 0; s < samples_per_pixel; ++s) {
                 auto u = (i + random_double()) / (image_width - 1);
                 auto v = (j + random_double()) / (image_height - 1);
                 Ray r = camera.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, lights, max_depth);
+                pixel_color += ray_color(r, background, *scene, lights.get(), max_depth);
             }
             
             image_data.get()[j * image_width + i] = pixel_color;
         }
+#ifdef BVH_STATS
+        bvh_stats_flush();
+#endif
         std::atomic_fetch_sub(&lines_remaining, 1);
         /* First thread to report the progress */
         if (omp_get_thread_num() == 0) std::cerr << "\rImage lines remaining: " << lines_remaining.load() << ' ' << std::flush;
     }
     std::cerr << std::endl;
 
+#ifdef BVH_STATS
+    bvh_stats_totals().print(std::cout);
+#endif
+
     CreateImage(image_data, "test.ppm", image_width, image_height, samples_per_pixel);
 
     system("pause");
@@ -6,6 +6,10 @@
 
 #include "geometry/Hittable.hpp"
 
+/*
+    A density of directions to sample. PDFs are values that live on the stack for one bounce, the mixture and
+    the hittable PDF only reference what they sample, so nothing is allocated per bounce
+*/
 class PDF {
 public:
     virtual ~PDF() {}
@@ -17,6 +21,8 @@ public:
 
 class CosinePDF : public PDF {
 public:
+    CosinePDF() {}
+
     CosinePDF(const Vector3& w) { 
         uvw.build_from_w(w); 
     }
@@ -35,9 +41,10 @@ public:
 };
 
 
+/* Directions towards object from origin, object must outlive the PDF */
 class HittablePDF : public PDF {
 public:
-    HittablePDF(shared_ptr<Hittable> p, const Point3& origin) :ptr_(p), o_(origin) {};
+    HittablePDF(const Hittable& object, const Point3& origin) : o_(origin), ptr_(&object) {};
 
     virtual Real value(const Vector3& direction) const override {
         return ptr_->pdf_value(o_, direction);
@@ -49,15 +56,16 @@ public:
 
 public:
     Point3 o_;
-    shared_ptr<Hittable> ptr_;
+    const Hittable* ptr_;
 };
 
 
+/* Even mixture of p1 and p2, which must outlive it */
 class MixturePDF : public PDF {
 public:
-    MixturePDF(shared_ptr<PDF> p1, shared_ptr<PDF> p2) {
-        p_[0] = p1;
-        p_[1] = p2;
+    MixturePDF(const PDF& p1, const PDF& p2) {
+        p_[0] = &p1;
+        p_[1] = &p2;
     };
 
     virtual Real value(const Vector3& direction) const override {
@@ -72,7 +80,7 @@ public:
     }
 
 public:
-    shared_ptr<PDF> p_[2];
+    const PDF* p_[2];
 };
 
 #endif
\ No newline at end of file
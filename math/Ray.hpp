@@ -9,6 +9,10 @@ public:
     Ray(const Point3& origin, const Vector3& direction, Real time = 0)
         : origin_(origin), direction_(direction), time_(time)
     {
+        for (int a = 0; a < 3; a++) {
+            inv_direction_.e[a] = 1 / direction.e[a];
+            dir_is_neg_[a] = inv_direction_.e[a] < 0;
+        }
     }
 
     Point3 origin() const { 
@@ -21,6 +25,11 @@ public:
         return time_;
     }
 
+    /* Reciprocal of the direction, infinite for zero components */
+    const Vector3& inv_direction() const {
+        return inv_direction_;
+    }
+
     Point3 at(Real t) const {
         return origin_ + t * direction_;
     }
@@ -29,6 +38,12 @@ public:
     Point3 origin_;
     Vector3 direction_;
     Real time_;
+    /*
+        Cached for the box tests, which share them over a whole traversal. Only set by the constructor,
+        so a ray with a new direction has to be constructed again. dir_is_neg_ also holds for -0
+    */
+    Vector3 inv_direction_;
+    int dir_is_neg_[3];
 };
 
 #endif
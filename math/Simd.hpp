@@ -0,0 +1,143 @@
+#ifndef __Simd_hpp__
+#define __Simd_hpp__
+
+#include "Real.hpp"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    A group of Reals processed together, so that the batched primitives write their kernels once. The group
+    is 4 lanes with AVX, 2 with SSE2, or a single Real otherwise. Comparisons give a SimdMask, with all the
+    bits of a lane set where the comparison holds
+*/
+#if defined(__AVX__)
+
+static const int simd_width = 4;
+
+struct SimdMask {
+    __m256d v_;
+
+    /* Bit i set for every true lane i */
+    int bits() const { return _mm256_movemask_pd(v_); }
+};
+
+struct SimdReal {
+    __m256d v_;
+
+    SimdReal() {}
+    SimdReal(__m256d v) : v_(v) {}
+    explicit SimdReal(Real x) : v_(_mm256_set1_pd(x)) {}
+
+    static SimdReal load(const Real* p) { return _mm256_loadu_pd(p); }
+    void store(Real* p) const { _mm256_storeu_pd(p, v_); }
+};
+
+inline SimdReal operator+(SimdReal a, SimdReal b) { return _mm256_add_pd(a.v_, b.v_); }
+inline SimdReal operator-(SimdReal a, SimdReal b) { return _mm256_sub_pd(a.v_, b.v_); }
+inline SimdReal operator*(SimdReal a, SimdReal b) { return _mm256_mul_pd(a.v_, b.v_); }
+inline SimdReal operator/(SimdReal a, SimdReal b) { return _mm256_div_pd(a.v_, b.v_); }
+inline SimdReal sqrt(SimdReal a) { return _mm256_sqrt_pd(a.v_); }
+inline SimdReal max(SimdReal a, SimdReal b) { return _mm256_max_pd(a.v_, b.v_); }
+inline SimdReal abs(SimdReal a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v_); }
+
+inline SimdMask operator<(SimdReal a, SimdReal b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_LT_OQ) }; }
+inline SimdMask operator<=(SimdReal a, SimdReal b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_LE_OQ) }; }
+inline SimdMask operator>(SimdReal a, SimdReal b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_GT_OQ) }; }
+inline SimdMask operator>=(SimdReal a, SimdReal b) { return { _mm256_cmp_pd(a.v_, b.v_, _CMP_GE_OQ) }; }
+inline SimdMask operator&(SimdMask a, SimdMask b) { return { _mm256_and_pd(a.v_, b.v_) }; }
+inline SimdMask operator|(SimdMask a, SimdMask b) { return { _mm256_or_pd(a.v_, b.v_) }; }
+
+/* a where mask is set, b elsewhere */
+inline SimdReal select(SimdMask mask, SimdReal a, SimdReal b) { return _mm256_blendv_pd(b.v_, a.v_, mask.v_); }
+
+#elif defined(__SSE2__)
+
+static const int simd_width = 2;
+
+struct SimdMask {
+    __m128d v_;
+
+    int bits() const { return _mm_movemask_pd(v_); }
+};
+
+struct SimdReal {
+    __m128d v_;
+
+    SimdReal() {}
+    SimdReal(__m128d v) : v_(v) {}
+    explicit SimdReal(Real x) : v_(_mm_set1_pd(x)) {}
+
+    static SimdReal load(const Real* p) { return _mm_loadu_pd(p); }
+    void store(Real* p) const { _mm_storeu_pd(p, v_); }
+};
+
+inline SimdReal operator+(SimdReal a, SimdReal b) { return _mm_add_pd(a.v_, b.v_); }
+inline SimdReal operator-(SimdReal a, SimdReal b) { return _mm_sub_pd(a.v_, b.v_); }
+inline SimdReal operator*(SimdReal a, SimdReal b) { return _mm_mul_pd(a.v_, b.v_); }
+inline SimdReal operator/(SimdReal a, SimdReal b) { return _mm_div_pd(a.v_, b.v_); }
+inline SimdReal sqrt(SimdReal a) { return _mm_sqrt_pd(a.v_); }
+inline SimdReal max(SimdReal a, SimdReal b) { return _mm_max_pd(a.v_, b.v_); }
+inline SimdReal abs(SimdReal a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a.v_); }
+
+inline SimdMask operator<(SimdReal a, SimdReal b) { return { _mm_cmplt_pd(a.v_, b.v_) }; }
+inline SimdMask operator<=(SimdReal a, SimdReal b) { return { _mm_cmple_pd(a.v_, b.v_) }; }
+inline SimdMask operator>(SimdReal a, SimdReal b) { return { _mm_cmpgt_pd(a.v_, b.v_) }; }
+inline SimdMask operator>=(SimdReal a, SimdReal b) { return { _mm_cmpge_pd(a.v_, b.v_) }; }
+inline SimdMask operator&(SimdMask a, SimdMask b) { return { _mm_and_pd(a.v_, b.v_) }; }
+inline SimdMask operator|(SimdMask a, SimdMask b) { return { _mm_or_pd(a.v_, b.v_) }; }
+
+/* SSE2 has no blend, the lanes are picked with the mask bits */
+inline SimdReal select(SimdMask mask, SimdReal a, SimdReal b) { return _mm_or_pd(_mm_and_pd(mask.v_, a.v_), _mm_andnot_pd(mask.v_, b.v_)); }
+
+#else
+
+static const int simd_width = 1;
+
+struct SimdMask {
+    bool v_;
+
+    int bits() const { return v_ ? 1 : 0; }
+};
+
+struct SimdReal {
+    Real v_;
+
+    SimdReal() {}
+    explicit SimdReal(Real x) : v_(x) {}
+
+    static SimdReal load(const Real* p) { return SimdReal(*p); }
+    void store(Real* p) const { *p = v_; }
+};
+
+inline SimdReal operator+(SimdReal a, SimdReal b) { return SimdReal(a.v_ + b.v_); }
+inline SimdReal operator-(SimdReal a, SimdReal b) { return SimdReal(a.v_ - b.v_); }
+inline SimdReal operator*(SimdReal a, SimdReal b) { return SimdReal(a.v_ * b.v_); }
+inline SimdReal operator/(SimdReal a, SimdReal b) { return SimdReal(a.v_ / b.v_); }
+inline SimdReal sqrt(SimdReal a) { return SimdReal(std::sqrt(a.v_)); }
+inline SimdReal max(SimdReal a, SimdReal b) { return SimdReal(a.v_ > b.v_ ? a.v_ : b.v_); }
+inline SimdReal abs(SimdReal a) { return SimdReal(std::fabs(a.v_)); }
+
+inline SimdMask operator<(SimdReal a, SimdReal b) { return { a.v_ < b.v_ }; }
+inline SimdMask operator<=(SimdReal a, SimdReal b) { return { a.v_ <= b.v_ }; }
+inline SimdMask operator>(SimdReal a, SimdReal b) { return { a.v_ > b.v_ }; }
+inline SimdMask operator>=(SimdReal a, SimdReal b) { return { a.v_ >= b.v_ }; }
+inline SimdMask operator&(SimdMask a, SimdMask b) { return { a.v_ && b.v_ }; }
+inline SimdMask operator|(SimdMask a, SimdMask b) { return { a.v_ || b.v_ }; }
+
+inline SimdReal select(SimdMask mask, SimdReal a, SimdReal b) { return mask.v_ ? a : b; }
+
+#endif
+
+/* Lane mask with the first n lanes set, for groups that run past the end of a range */
+inline int simd_lanes_below(int n)
+{
+    return n >= simd_width ? (1 << simd_width) - 1 : (1 << n) - 1;
+}
+
+#endif
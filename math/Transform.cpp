@@ -0,0 +1,126 @@
+#include "Transform.hpp"
+
+#include <cstring>
+
+/* Inverse of the affine 3x4 matrix m, stored in inv. The upper 3x3 is inverted through its adjugate */
+static void invert(const Real m[3][4], Real inv[3][4])
+{
+    Real c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    Real c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    Real c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    Real det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+
+    if (det == 0) {
+        std::cerr << "Singular matrix in Transform.\n";
+        det = 1;
+    }
+    Real inv_det = 1 / det;
+
+    inv[0][0] = c00 * inv_det;
+    inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+    inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+    inv[1][0] = c01 * inv_det;
+    inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+    inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+    inv[2][0] = c02 * inv_det;
+    inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+    inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+    /* The inverse translation is the translation, moved back by the inverse linear part */
+    for (int i = 0; i < 3; i++)
+        inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+}
+
+Transform::Transform()
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            m_[i][j] = (i == j) ? 1 : 0;
+            inv_[i][j] = m_[i][j];
+        }
+    }
+}
+
+Transform::Transform(const Real m[3][4])
+{
+    std::memcpy(m_, m, sizeof(m_));
+    invert(m_, inv_);
+}
+
+Transform Transform::translate(const Vector3 & offset)
+{
+    Transform t;
+    for (int i = 0; i < 3; i++) {
+        t.m_[i][3] = offset[i];
+        t.inv_[i][3] = -offset[i];
+    }
+    return t;
+}
+
+Transform Transform::rotate_y(Real angle)
+{
+    return rotate(Vector3(0, 1, 0), angle);
+}
+
+Transform Transform::rotate(const Vector3 & axis, Real angle)
+{
+    auto a = unit_vector(axis);
+    auto radians = degrees_to_radians(angle);
+    auto sin_theta = sin(radians);
+    auto cos_theta = cos(radians);
+
+    /* Rodrigues' rotation formula. A rotation matrix is orthonormal, its inverse is the transpose */
+    Transform t;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            t.m_[i][j] = a[i] * a[j] * (1 - cos_theta) + ((i == j) ? cos_theta : 0);
+        }
+    }
+    t.m_[0][1] -= a.z() * sin_theta;
+    t.m_[0][2] += a.y() * sin_theta;
+    t.m_[1][0] += a.z() * sin_theta;
+    t.m_[1][2] -= a.x() * sin_theta;
+    t.m_[2][0] -= a.y() * sin_theta;
+    t.m_[2][1] += a.x() * sin_theta;
+
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            t.inv_[i][j] = t.m_[j][i];
+
+    return t;
+}
+
+Transform Transform::scale(const Vector3 & factors)
+{
+    Real m[3][4] = {
+        { factors.x(), 0, 0, 0 },
+        { 0, factors.y(), 0, 0 },
+        { 0, 0, factors.z(), 0 },
+    };
+    return Transform(m);
+}
+
+Transform Transform::operator*(const Transform & t) const
+{
+    Transform result;
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m_[i][j] = m_[i][0] * t.m_[0][j] + m_[i][1] * t.m_[1][j] + m_[i][2] * t.m_[2][j];
+            result.inv_[i][j] = t.inv_[i][0] * inv_[0][j] + t.inv_[i][1] * inv_[1][j] + t.inv_[i][2] * inv_[2][j];
+        }
+        /* The implicit fourth row (0, 0, 0, 1) contributes the translation */
+        result.m_[i][3] += m_[i][3];
+        result.inv_[i][3] += t.inv_[i][3];
+    }
+
+    return result;
+}
+
+Transform Transform::inverse() const
+{
+    Transform result;
+    std::memcpy(result.m_, inv_, sizeof(m_));
+    std::memcpy(result.inv_, m_, sizeof(m_));
+    return result;
+}
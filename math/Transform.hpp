@@ -0,0 +1,73 @@
+#ifndef __Transform_hpp__
+#define __Transform_hpp__
+
+#include "Common.hpp"
+#include "Vector3.hpp"
+
+/*
+    An affine transformation, stored as the 3x4 matrix and its inverse, so that transforming in
+    either direction is a matrix multiplication
+*/
+class Transform {
+public:
+    /* The identity transformation */
+    Transform();
+
+    /* Transformation from the 3x4 matrix m, the inverse is computed */
+    Transform(const Real m[3][4]);
+
+    static Transform translate(const Vector3& offset);
+    /* Rotation around the Y axis, in degrees */
+    static Transform rotate_y(Real angle);
+    /* Rotation around an arbitrary axis, in degrees */
+    static Transform rotate(const Vector3& axis, Real angle);
+    static Transform scale(const Vector3& factors);
+
+    /* The transformation that applies t first, and then this one */
+    Transform operator*(const Transform& t) const;
+
+    Transform inverse() const;
+
+    Point3 point(const Point3& p) const {
+        return Point3(
+            m_[0][0] * p.x() + m_[0][1] * p.y() + m_[0][2] * p.z() + m_[0][3],
+            m_[1][0] * p.x() + m_[1][1] * p.y() + m_[1][2] * p.z() + m_[1][3],
+            m_[2][0] * p.x() + m_[2][1] * p.y() + m_[2][2] * p.z() + m_[2][3]);
+    }
+
+    Vector3 vector(const Vector3& v) const {
+        return Vector3(
+            m_[0][0] * v.x() + m_[0][1] * v.y() + m_[0][2] * v.z(),
+            m_[1][0] * v.x() + m_[1][1] * v.y() + m_[1][2] * v.z(),
+            m_[2][0] * v.x() + m_[2][1] * v.y() + m_[2][2] * v.z());
+    }
+
+    /* Normals are transformed by the inverse transpose, the result is not normalized */
+    Vector3 normal(const Vector3& n) const {
+        return Vector3(
+            inv_[0][0] * n.x() + inv_[1][0] * n.y() + inv_[2][0] * n.z(),
+            inv_[0][1] * n.x() + inv_[1][1] * n.y() + inv_[2][1] * n.z(),
+            inv_[0][2] * n.x() + inv_[1][2] * n.y() + inv_[2][2] * n.z());
+    }
+
+    /* The same transformations, with the inverse */
+    Point3 inverse_point(const Point3& p) const {
+        return Point3(
+            inv_[0][0] * p.x() + inv_[0][1] * p.y() + inv_[0][2] * p.z() + inv_[0][3],
+            inv_[1][0] * p.x() + inv_[1][1] * p.y() + inv_[1][2] * p.z() + inv_[1][3],
+            inv_[2][0] * p.x() + inv_[2][1] * p.y() + inv_[2][2] * p.z() + inv_[2][3]);
+    }
+
+    Vector3 inverse_vector(const Vector3& v) const {
+        return Vector3(
+            inv_[0][0] * v.x() + inv_[0][1] * v.y() + inv_[0][2] * v.z(),
+            inv_[1][0] * v.x() + inv_[1][1] * v.y() + inv_[1][2] * v.z(),
+            inv_[2][0] * v.x() + inv_[2][1] * v.y() + inv_[2][2] * v.z());
+    }
+
+public:
+    Real m_[3][4];
+    Real inv_[3][4];
+};
+
+#endif